@@ -349,8 +349,8 @@ void module1_parse_uart_commands(buf_t *buf)
 
 	if (buf_get_sbuf_upto_and_skip(buf, &s, "rf buf") >= 0) {
 		LOG("\nifce pool: %d rx: %d tx:%d\npkt pool: %d\n",
-		    ring_len(rf_iface.pkt_pool), ring_len(rf_iface.rx),
-		    ring_len(rf_iface.tx), pkt_pool_get_nb_free());
+		    pkt_ring_len(rf_iface.pkt_pool), pkt_ring_len(rf_iface.rx),
+		    pkt_ring_len(rf_iface.tx), pkt_pool_get_nb_free());
 		return;
 	}
 
@@ -35,9 +35,9 @@ const uint32_t rf_enc_defkey[4] = {
 static uint8_t EEMEM eeprom_magic;
 
 static struct iface_queues {
-	RING_DECL_IN_STRUCT(pkt_pool, CONFIG_PKT_DRIVER_NB_MAX);
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(pkt_pool, PKT_RING_SIZE(CONFIG_PKT_DRIVER_NB_MAX));
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 } iface_queues = {
 	.pkt_pool = RING_INIT(iface_queues.pkt_pool),
 	.rx = RING_INIT(iface_queues.rx),
@@ -50,9 +50,9 @@ static rf_ctx_t ctx;
 #error "CONFIG_AVR_SIMU must be enabled with RF_DEBUG"
 #endif
 static struct debug_iface_queues {
-	RING_DECL_IN_STRUCT(pkt_pool, CONFIG_PKT_DRIVER_NB_MAX);
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(pkt_pool, PKT_RING_SIZE(CONFIG_PKT_DRIVER_NB_MAX));
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 } debug_iface_queues = {
 	.pkt_pool = RING_INIT(debug_iface_queues.pkt_pool),
 	.rx = RING_INIT(debug_iface_queues.rx),
@@ -482,8 +482,8 @@ void alarm_parse_uart_commands(buf_t *buf)
 	}
 	if (ifce) {
 		LOG("\nifce pool: %d rx: %d tx:%d\npkt pool: %d\n",
-		    ring_len(ifce->pkt_pool), ring_len(ifce->rx),
-		    ring_len(ifce->tx), pkt_pool_get_nb_free());
+		    pkt_ring_len(ifce->pkt_pool), pkt_ring_len(ifce->rx),
+		    pkt_ring_len(ifce->tx), pkt_pool_get_nb_free());
 		return;
 	}
 
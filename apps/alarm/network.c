@@ -49,9 +49,9 @@ iface_t eth_iface = {
 };
 
 static struct iface_queues {
-	RING_DECL_IN_STRUCT(pkt_pool, CONFIG_PKT_DRIVER_NB_MAX);
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(pkt_pool, PKT_RING_SIZE(CONFIG_PKT_DRIVER_NB_MAX));
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 } iface_queues = {
 	.pkt_pool = RING_INIT(iface_queues.pkt_pool),
 	.rx = RING_INIT(iface_queues.rx),
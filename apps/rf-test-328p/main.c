@@ -117,12 +117,12 @@ static cmd_t cmds[] = {
 static iface_t rf_iface;
 static rf_ctx_t rf_ctx;
 static struct iface_queues {
-	RING_DECL_IN_STRUCT(pkt_pool, CONFIG_PKT_DRIVER_NB_MAX);
+	RING_DECL_IN_STRUCT(pkt_pool, PKT_RING_SIZE(CONFIG_PKT_DRIVER_NB_MAX));
 #ifdef CONFIG_RF_RECEIVER
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 #endif
 #ifdef CONFIG_RF_SENDER
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 #endif
 } iface_queues = {
 	.pkt_pool = RING_INIT(iface_queues.pkt_pool),
@@ -165,14 +165,14 @@ static void print_stats(void)
 {
 	if_dump_stats(&rf_iface);
 	LOG("\nifce pool: %d rx: %d tx:%d\npkt pool: %d\n",
-	    ring_len(rf_iface.pkt_pool),
+	    pkt_ring_len(rf_iface.pkt_pool),
 #ifdef CONFIG_RF_RECEIVER
-	    ring_len(rf_iface.rx),
+	    pkt_ring_len(rf_iface.rx),
 #else
 	    0,
 #endif
 #ifdef CONFIG_RF_SENDER
-	    ring_len(rf_iface.tx),
+	    pkt_ring_len(rf_iface.tx),
 #else
 	    0,
 #endif
@@ -27,6 +27,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <x86intrin.h>
+#include <pthread.h>
+#include <sched.h>
+#include <interrupts.h>
 
 #include <sys/array.h>
 #include <sys/ring.h>
@@ -34,16 +40,18 @@
 #include <sys/hash-tables.h>
 #include <sys/timer.h>
 #include <sys/scheduler.h>
+#include <sys/chksum.h>
 #include <net/tests.h>
+#include <net/event.h>
 #include <drivers/rf.h>
 #include <drivers/rf-checks.h>
 #include <drivers/gsm-at.h>
 
 #define CHK_RSIZE 64
 static struct iface_queues {
-	RING_DECL_IN_STRUCT(pkt_pool, CONFIG_PKT_DRIVER_NB_MAX);
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(pkt_pool, PKT_RING_SIZE(CONFIG_PKT_DRIVER_NB_MAX));
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 } iface_queues = {
 	.pkt_pool = RING_INIT(iface_queues.pkt_pool),
 	.rx = RING_INIT(iface_queues.rx),
@@ -169,6 +177,229 @@ static int ring_check(void)
 	return 0;
 }
 
+#define RING_SPAN_SIZE 2048
+#define RING_SPAN_ROUNDS 2000
+
+static void ring_bytes_add(ring_t *ring, const uint8_t *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		__ring_addc(ring, data[i]);
+}
+
+static void ring_bytes_get(ring_t *ring, uint8_t *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		__ring_getc(ring, &data[i]);
+}
+
+static int ring_span_check(void)
+{
+	RING_DECL(ring, RING_SPAN_SIZE);
+	static uint8_t in[RING_SPAN_SIZE], out[RING_SPAN_SIZE];
+	static const int sizes[] = { 4, 16, 64, 256, 1024 };
+	ring_span_t span[2];
+	uint64_t start, bytes_cycles, span_cycles;
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = i * 13;
+
+	/* reserve room across the end of the ring and write in place */
+	ring->head = ring->tail = RING_SPAN_SIZE - 10;
+	if (ring_reserve(ring, RING_SPAN_SIZE, span) >= 0
+	    || ring_reserve(ring, 30, span) < 0
+	    || span[0].len != 10 || span[1].len != 20
+	    || span[1].data != ring->data)
+		return -1;
+	memcpy(span[0].data, in, span[0].len);
+	memcpy(span[1].data, in + span[0].len, span[1].len);
+	if (!ring_is_empty(ring))
+		return -1;
+	ring_commit(ring, 30);
+	if (ring_len(ring) != 30 || ring_data_spans(ring, span) != 2
+	    || ring_cmp(ring, in, 30))
+		return -1;
+	__ring_peek(ring, out, 30);
+	if (memcmp(in, out, 30))
+		return -1;
+	ring_skip(ring, 30);
+	if (ring_data_spans(ring, span) != 0)
+		return -1;
+
+	for (i = 0; i < countof(sizes); i++) {
+		int len = sizes[i];
+
+		ring_reset(ring);
+		start = __rdtsc();
+		for (j = 0; j < RING_SPAN_ROUNDS; j++) {
+			ring_bytes_add(ring, in, len);
+			ring_bytes_get(ring, out, len);
+		}
+		bytes_cycles = __rdtsc() - start;
+
+		ring_reset(ring);
+		start = __rdtsc();
+		for (j = 0; j < RING_SPAN_ROUNDS; j++) {
+			ring_add(ring, in, len);
+			__ring_peek(ring, out, len);
+			__ring_skip(ring, len);
+		}
+		span_cycles = __rdtsc() - start;
+		if (memcmp(in, out, len) || !ring_is_empty(ring))
+			return -1;
+		printf("ring spans: %4d bytes: %5lu cycles (byte loop: %lu)\n",
+		       len, (unsigned long)(span_cycles / RING_SPAN_ROUNDS),
+		       (unsigned long)(bytes_cycles / RING_SPAN_ROUNDS));
+	}
+	return 0;
+}
+
+#define RING_MP_NB       64
+#define RING_MP_PRODUCERS 2
+#define RING_MP_CONSUMERS 2
+#define RING_MP_ELEMS    200000 /* per producer */
+#define RING_MP_BULK     8
+
+static struct {
+	RING_MP_DECL_IN_STRUCT(ring, RING_MP_NB, sizeof(uint32_t));
+} ring_mp_g = {
+	.ring = RING_MP_INIT(ring_mp_g.ring, sizeof(uint32_t)),
+};
+static uint8_t *ring_mp_seen;
+static volatile unsigned ring_mp_consumed;
+
+static void *ring_mp_producer(void *arg)
+{
+	uint32_t base = (uintptr_t)arg * RING_MP_ELEMS;
+	uint32_t vals[RING_MP_BULK];
+	unsigned i, j, n;
+
+	for (i = 0; i < RING_MP_ELEMS; i += n) {
+		/* bulks of 1 to RING_MP_BULK elements */
+		n = MIN(i % RING_MP_BULK + 1, RING_MP_ELEMS - i);
+		for (j = 0; j < n; j++)
+			vals[j] = base + i + j;
+		while (ring_mp_enqueue_bulk(&ring_mp_g.ring, vals, n) < 0)
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void *ring_mp_consumer(void *arg)
+{
+	unsigned total = RING_MP_PRODUCERS * RING_MP_ELEMS;
+	uint32_t vals[RING_MP_BULK];
+	unsigned j, n = (uintptr_t)arg;
+
+	while (ring_mp_consumed < total) {
+		if (ring_mc_dequeue_bulk(&ring_mp_g.ring, vals, n) < 0) {
+			/* drain the leftovers one by one */
+			n = 1;
+			sched_yield();
+			continue;
+		}
+		for (j = 0; j < n; j++)
+			__sync_add_and_fetch(&ring_mp_seen[vals[j]], 1);
+		__sync_add_and_fetch(&ring_mp_consumed, n);
+	}
+	return NULL;
+}
+
+static int ring_mp_stress_check(void)
+{
+	pthread_t prod[RING_MP_PRODUCERS], cons[RING_MP_CONSUMERS];
+	unsigned total = RING_MP_PRODUCERS * RING_MP_ELEMS;
+	uint64_t start, cycles;
+	unsigned i;
+	int ret = -1;
+
+	if ((ring_mp_seen = calloc(total, 1)) == NULL)
+		return -1;
+	start = __rdtsc();
+	for (i = 0; i < RING_MP_CONSUMERS; i++)
+		pthread_create(&cons[i], NULL, ring_mp_consumer,
+			       (void *)(uintptr_t)(i + 1));
+	for (i = 0; i < RING_MP_PRODUCERS; i++)
+		pthread_create(&prod[i], NULL, ring_mp_producer,
+			       (void *)(uintptr_t)i);
+	for (i = 0; i < RING_MP_PRODUCERS; i++)
+		pthread_join(prod[i], NULL);
+	for (i = 0; i < RING_MP_CONSUMERS; i++)
+		pthread_join(cons[i], NULL);
+	cycles = __rdtsc() - start;
+
+	for (i = 0; i < total; i++) {
+		if (ring_mp_seen[i] != 1) {
+			fprintf(stderr, "%s: element %u seen %u times\n",
+				__func__, i, ring_mp_seen[i]);
+			goto end;
+		}
+	}
+	if (!ring_mp_is_empty(&ring_mp_g.ring))
+		goto end;
+	printf("ring mp: %u elements, %d producers, %d consumers, "
+	       "%lu cycles per element\n", total, RING_MP_PRODUCERS,
+	       RING_MP_CONSUMERS, (unsigned long)(cycles / total));
+	ret = 0;
+ end:
+	free(ring_mp_seen);
+	return ret;
+}
+
+static int ring_mp_check(void)
+{
+	ring_mp_t *ring = &ring_mp_g.ring;
+	uint32_t in[RING_MP_NB], out[RING_MP_NB];
+	uint64_t start, cycles;
+	unsigned i;
+
+	for (i = 0; i < RING_MP_NB; i++)
+		in[i] = i * 7;
+	/* the data follows the ring header */
+	if (ring->data != ring_mp_g.ring_data)
+		return -1;
+
+	/* bulks are all or nothing and wrap around */
+	for (i = 0; i < 3; i++) {
+		if (ring_mp_enqueue_bulk(ring, in, RING_MP_NB - 5) < 0
+		    || ring_mp_enqueue_bulk(ring, in, 6) >= 0
+		    || ring_mp_len(ring) != RING_MP_NB - 5
+		    || ring_mc_dequeue_bulk(ring, out, RING_MP_NB - 4) >= 0
+		    || ring_mc_dequeue_bulk(ring, out, RING_MP_NB - 5) < 0
+		    || memcmp(in, out, (RING_MP_NB - 5) * sizeof(uint32_t))
+		    || !ring_mp_is_empty(ring))
+			return -1;
+	}
+	if (ring_sp_enqueue_bulk(ring, in, RING_MP_NB) < 0
+	    || ring_sp_enqueue_bulk(ring, in, 1) >= 0
+	    || ring_sc_dequeue_bulk(ring, out, RING_MP_NB) < 0
+	    || memcmp(in, out, sizeof(in)))
+		return -1;
+
+	/* single thread throughput */
+	start = __rdtsc();
+	for (i = 0; i < RING_MP_ELEMS; i += RING_MP_BULK) {
+		ring_mp_enqueue_bulk(ring, in, RING_MP_BULK);
+		ring_mc_dequeue_bulk(ring, out, RING_MP_BULK);
+	}
+	cycles = __rdtsc() - start;
+	printf("ring mp: %lu cycles per element in bulks of %d",
+	       (unsigned long)(cycles / RING_MP_ELEMS), RING_MP_BULK);
+	start = __rdtsc();
+	for (i = 0; i < RING_MP_ELEMS; i++) {
+		ring_sp_enqueue_bulk(ring, in, 1);
+		ring_sc_dequeue_bulk(ring, out, 1);
+	}
+	cycles = __rdtsc() - start;
+	printf(", %lu single sp/sc\n", (unsigned long)(cycles / RING_MP_ELEMS));
+
+	return ring_mp_stress_check();
+}
+
 typedef struct list_el {
 	list_t list;
 	slist_node_t slist;
@@ -313,7 +544,73 @@ static int slist_check(void)
 	return 0;
 }
 
-#ifdef CONFIG_HT_STORAGE
+#define HTABLE_BENCH_ROUNDS 100000
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* fill the table up to 3/4 and measure add/lookup/del costs */
+static int htable_bench(hash_table_t *htable)
+{
+	int nb = htable->size * 3 / 4, i;
+	uint64_t start, add_ns, lookup_ns, del_ns;
+
+	if (nb == 0)
+		nb = 1;
+
+	start = time_ns();
+	for (i = 0; i < nb; i++) {
+		int k = 1000 + i;
+		sbuf_t key, val;
+
+		sbuf_init(&key, &k, sizeof(k));
+		sbuf_init(&val, &i, sizeof(i));
+		if (htable_add(htable, &key, &val) < 0) {
+			fprintf(stderr, "htable: can't add entry %d\n", i);
+			return -1;
+		}
+	}
+	add_ns = time_ns() - start;
+
+	start = time_ns();
+	for (i = 0; i < HTABLE_BENCH_ROUNDS; i++) {
+		int k = 1000 + i % nb;
+		sbuf_t key, *val;
+
+		sbuf_init(&key, &k, sizeof(k));
+		if (htable_lookup(htable, &key, &val) < 0
+		    || *(int *)val->data != i % nb) {
+			fprintf(stderr, "htable: can't find entry %d\n", i % nb);
+			return -1;
+		}
+	}
+	lookup_ns = time_ns() - start;
+
+	start = time_ns();
+	for (i = 0; i < nb; i++) {
+		int k = 1000 + i;
+		sbuf_t key;
+
+		sbuf_init(&key, &k, sizeof(k));
+		if (htable_del(htable, &key) < 0) {
+			fprintf(stderr, "htable: can't delete entry %d\n", i);
+			return -1;
+		}
+	}
+	del_ns = time_ns() - start;
+
+	printf("htable (size: %d, entries: %d): add: %u ns, lookup: %u ns, "
+	       "del: %u ns\n", htable->size, nb, (unsigned)(add_ns / nb),
+	       (unsigned)(lookup_ns / HTABLE_BENCH_ROUNDS),
+	       (unsigned)(del_ns / nb));
+	return 0;
+}
+
 static int htable_check(int htable_size)
 {
 	HTABLE_DECL(htable, htable_size);
@@ -467,9 +764,114 @@ static int htable_check(int htable_size)
 
 	htable_free(&htable);
 
+	return htable_bench(&htable);
+}
+
+#define CKSUM_BUF_LEN      1500
+#define CKSUM_BENCH_ROUNDS 100000
+
+static double cksum_bench(uint32_t (*cksum_fn)(const void *, uint16_t),
+			  const uint8_t *data)
+{
+	volatile uint32_t sum = 0;
+	uint64_t start;
+	int i;
+
+	start = __rdtsc();
+	for (i = 0; i < CKSUM_BENCH_ROUNDS; i++)
+		sum += cksum_fn(data, CKSUM_BUF_LEN);
+	(void)sum;
+	return (double)CKSUM_BUF_LEN * CKSUM_BENCH_ROUNDS
+		/ (__rdtsc() - start);
+}
+
+/* compare with the portable version on unaligned buffers of any length */
+static int cksum_check(void)
+{
+	static uint8_t data[CKSUM_BUF_LEN + 16];
+	uint8_t hdr[20];
+	uint16_t csum, word;
+	uint32_t addr;
+	int i, off, len;
+
+	for (i = 0; i < (int)sizeof(data); i++)
+		data[i] = rand();
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len <= CKSUM_BUF_LEN; len++) {
+			if (cksum_finish(cksum_partial(data + off, len))
+			    != cksum_finish(__cksum_partial(data + off, len))) {
+				fprintf(stderr, "%s: bad checksum (off:%d len:%d)\n",
+					__func__, off, len);
+				return -1;
+			}
+		}
+	}
+
+	/* checksum while copying in and out of a buffer */
+	for (len = 0; len <= 64; len++) {
+		uint8_t copy[64];
+		uint32_t csum_in = 0, csum_out = 0;
+		buf_t buf = BUF(64);
+
+		if (buf_add_and_csum(&buf, data + 1, len, &csum_in) < 0
+		    || buf_get_and_csum(&buf, copy, len, &csum_out) < 0
+		    || memcmp(copy, data + 1, len)
+		    || cksum_finish(csum_in) != cksum(data + 1, len)
+		    || cksum_finish(csum_out) != cksum(data + 1, len)) {
+			fprintf(stderr, "%s: bad checksum copy (len:%d)\n",
+				__func__, len);
+			return -1;
+		}
+	}
+	{
+		buf_t buf = BUF(8);
+		uint32_t csum = 0;
+
+		if (buf_add_and_csum(&buf, data, 9, &csum) >= 0) {
+			fprintf(stderr, "%s: buffer overflow\n", __func__);
+			return -1;
+		}
+	}
+
+	memset(data, 0xFF, sizeof(data));
+	if (cksum(data, CKSUM_BUF_LEN) != cksum_finish(__cksum_partial(data,
+						       CKSUM_BUF_LEN))) {
+		fprintf(stderr, "%s: bad checksum on 0xFF bytes\n", __func__);
+		return -1;
+	}
+
+	/* incremental updates, fields at offsets 8 and 12 */
+	for (i = 0; i < (int)sizeof(hdr); i++)
+		hdr[i] = rand();
+	memset(hdr + 10, 0, 2);
+	csum = cksum(hdr, sizeof(hdr));
+	memcpy(hdr + 10, &csum, 2);
+
+	memcpy(&word, hdr + 8, 2);
+	csum = cksum_update16(csum, word, word - 1);
+	word--;
+	memcpy(hdr + 8, &word, 2);
+	memcpy(hdr + 10, &csum, 2);
+	if (cksum(hdr, sizeof(hdr)) != 0) {
+		fprintf(stderr, "%s: bad 16-bit update\n", __func__);
+		return -1;
+	}
+	memcpy(&addr, hdr + 12, 4);
+	csum = cksum_update32(csum, addr, addr ^ 0xA5A55A5A);
+	addr ^= 0xA5A55A5A;
+	memcpy(hdr + 12, &addr, 4);
+	memcpy(hdr + 10, &csum, 2);
+	if (cksum(hdr, sizeof(hdr)) != 0) {
+		fprintf(stderr, "%s: bad 32-bit update\n", __func__);
+		return -1;
+	}
+
+	printf("cksum (%d bytes): generic: %.2f bytes/cycle, "
+	       "fast: %.2f bytes/cycle\n", CKSUM_BUF_LEN,
+	       cksum_bench(__cksum_partial, data + 1),
+	       cksum_bench(cksum_partial, data + 1));
 	return 0;
 }
-#endif
 
 typedef struct timer_el {
 	tim_t timer;
@@ -487,6 +889,184 @@ static void timer_cb(void *arg)
 	val_g++;
 }
 
+#define TIMER_BENCH_CNT 4096
+/* long timers spread over 1 to 10 seconds */
+#define TIMER_BENCH_MIN_US 1000000
+#define TIMER_BENCH_SPREAD_US 9000000
+
+typedef struct timer_bench_el {
+	tim_t timer;
+	uint32_t expires;
+	int fired;
+} timer_bench_el_t;
+
+static int timer_bench_fired;
+
+static void timer_bench_cb(void *arg)
+{
+	timer_bench_el_t *el = arg;
+
+	assert(el->expires == timer_ticks);
+	el->fired++;
+	timer_bench_fired++;
+}
+
+static int timer_bench(void)
+{
+	timer_bench_el_t *els;
+	uint64_t cycles = 0, start;
+	uint32_t ticks = 0;
+	int i;
+
+	els = calloc(TIMER_BENCH_CNT, sizeof(timer_bench_el_t));
+	if (els == NULL)
+		return -1;
+	timer_bench_fired = 0;
+
+	for (i = 0; i < TIMER_BENCH_CNT; i++) {
+		timer_bench_el_t *el = &els[i];
+		uint32_t expiry = TIMER_BENCH_MIN_US
+			+ ((uint32_t)i * 2654435761U) % TIMER_BENCH_SPREAD_US;
+
+		timer_init(&el->timer);
+		timer_add(&el->timer, expiry, timer_bench_cb, el);
+		el->expires = timer_ticks + expiry / CONFIG_TIMER_RESOLUTION_US;
+	}
+	/* re-arm a quarter of them to exercise deletion */
+	for (i = 0; i < TIMER_BENCH_CNT; i += 4) {
+		timer_bench_el_t *el = &els[i];
+
+		timer_del(&el->timer);
+		timer_reschedule(&el->timer, TIMER_BENCH_MIN_US);
+		el->expires = timer_ticks
+			+ TIMER_BENCH_MIN_US / CONFIG_TIMER_RESOLUTION_US;
+	}
+
+	while (timer_bench_fired < TIMER_BENCH_CNT) {
+		start = __rdtsc();
+		timer_process();
+		cycles += __rdtsc() - start;
+		if (++ticks > (TIMER_BENCH_MIN_US + TIMER_BENCH_SPREAD_US)
+		    / CONFIG_TIMER_RESOLUTION_US)
+			break;
+	}
+	for (i = 0; i < TIMER_BENCH_CNT; i++) {
+		if (els[i].fired != 1) {
+			fprintf(stderr, "%s: timer %d fired %d times\n",
+				__func__, i, els[i].fired);
+			free(els);
+			return -1;
+		}
+	}
+	printf("timer_process (%d timers, %u ticks): %lu cycles, "
+	       "%.2f cycles/tick\n", TIMER_BENCH_CNT, ticks,
+	       (unsigned long)cycles, (double)cycles / ticks);
+	free(els);
+	return 0;
+}
+
+#ifdef CONFIG_TIMER_TICKLESS
+#define TIMER_IDLE_TICKS (3600 * 1000000ULL / CONFIG_TIMER_RESOLUTION_US)
+
+static int timer_tickless_fired;
+
+static void timer_tickless_cb(void *arg)
+{
+	timer_tickless_fired++;
+}
+
+static int timer_tickless_check(void)
+{
+	tim_t timer_short, timer_long;
+	struct timespec start, end;
+	uint64_t cycles;
+	uint32_t ticks;
+	int64_t us;
+
+	/* don't account the time spent in the previous checks */
+	timer_subsystem_reset();
+	timer_init(&timer_short);
+	timer_init(&timer_long);
+	if (timer_next_expiry() >= 0 || timer_tickless_timeout() >= 0)
+		return -1;
+
+	/* long timers are reported no later than their expiry */
+	timer_add(&timer_long, 100000, timer_tickless_cb, NULL);
+	if (timer_next_expiry() <= 0 || timer_next_expiry()
+	    > 100000 / CONFIG_TIMER_RESOLUTION_US)
+		return -1;
+
+	timer_add(&timer_short, 2000, timer_tickless_cb, NULL);
+	if (timer_next_expiry() != 2000 / CONFIG_TIMER_RESOLUTION_US)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (timer_tickless_fired == 0) {
+		struct timespec ts;
+
+		if ((us = timer_tickless_timeout()) < 0)
+			return -1;
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+		timer_tickless_process();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = (end.tv_sec - start.tv_sec) * 1000000
+		+ (end.tv_nsec - start.tv_nsec) / 1000;
+	if (timer_is_pending(&timer_short) || us < 2000 - 2 *
+	    CONFIG_TIMER_RESOLUTION_US)
+		return -1;
+	timer_del(&timer_long);
+
+	/* an idle hour is caught up without stepping the wheel */
+	timer_add(&timer_long, 100000, timer_tickless_cb, NULL);
+	timer_tickless_fired = 0;
+	ticks = timer_ticks;
+	cycles = __rdtsc();
+	timer_ticks += TIMER_IDLE_TICKS - 1;
+	timer_process();
+	cycles = __rdtsc() - cycles;
+	if (timer_tickless_fired != 1 || timer_ticks != ticks + TIMER_IDLE_TICKS
+	    || timer_next_expiry() >= 0 || cycles >= TIMER_IDLE_TICKS) {
+		fprintf(stderr, "%s: bad catch-up (%lu cycles)\n", __func__,
+			(unsigned long)cycles);
+		return -1;
+	}
+	timer_add(&timer_short, 2000, timer_tickless_cb, NULL);
+	if (timer_next_expiry() != 2000 / CONFIG_TIMER_RESOLUTION_US)
+		return -1;
+	timer_del(&timer_short);
+	printf("timer catch-up (%lu idle ticks): %lu cycles\n",
+	       (unsigned long)TIMER_IDLE_TICKS, (unsigned long)cycles);
+	return 0;
+}
+#endif
+
+#ifndef CONFIG_TIMER_TICKLESS
+static int timer_deferred_check(void)
+{
+	uint32_t ticks = timer_ticks;
+	uint32_t deferred = timer_tick_stats.deferred;
+	uint8_t flags;
+
+	/* ticks landing in an irq_save() section must not be lost */
+	irq_save(flags);
+	raise(SIGALRM);
+	raise(SIGALRM);
+	raise(SIGALRM);
+	if (timer_ticks != ticks)
+		return -1;
+	irq_restore(flags);
+
+	if (timer_ticks != ticks + 3
+	    || timer_tick_stats.deferred != deferred + 3
+	    || timer_tick_stats.max_deferred < 3 || irq_pending_ticks)
+		return -1;
+	return 0;
+}
+#endif
+
 static int timer_check(void)
 {
 #define TIM_CNT 1024
@@ -508,11 +1088,358 @@ static int timer_check(void)
 	for (i = 0; i < TIMER_TABLE_SIZE * 2; i++) {
 		timer_process();
 	}
+	if (val_g != TIM_CNT) {
+		timer_subsystem_stop();
+		return -1;
+	}
+	if (timer_bench() < 0) {
+		timer_subsystem_stop();
+		return -1;
+	}
+#ifdef CONFIG_TIMER_TICKLESS
+	if (timer_tickless_check() < 0) {
+		timer_subsystem_stop();
+		return -1;
+	}
+#else
+	if (timer_deferred_check() < 0) {
+		timer_subsystem_stop();
+		return -1;
+	}
+#endif
 
 	timer_subsystem_stop();
 	return 0;
 }
 
+static char sched_order[8];
+static int sched_order_len;
+static int sched_high_runs;
+static uint8_t sched_high_busy;
+
+static void sched_order_cb(void *arg)
+{
+	if (sched_order_len < (int)sizeof(sched_order))
+		sched_order[sched_order_len++] = (char)(uintptr_t)arg;
+}
+
+static void sched_high_cb(void *arg)
+{
+	sched_high_runs++;
+	if (sched_high_busy)
+		schedule_task_prio(sched_high_cb, NULL, SCHEDULER_PRIO_HIGH);
+}
+
+static void scheduler_drain(void)
+{
+	while (scheduler_has_tasks())
+		scheduler_run_task();
+}
+
+#ifdef CONFIG_EVENT
+#define SCHED_FLOOD_EVENTS 256
+
+typedef struct sched_flood_ev {
+	event_t event;
+	list_t rx_queue;
+	list_t rx_item;
+	int calls;
+} sched_flood_ev_t;
+
+static void sched_flood_ev_cb(event_t *ev, uint8_t events)
+{
+	sched_flood_ev_t *fev = container_of(ev, sched_flood_ev_t, event);
+
+	/* consume the readable data */
+	list_del_init(&fev->rx_item);
+	fev->calls++;
+}
+
+/* flood the scheduler with more events than the task queues can hold */
+static int scheduler_flood_check(void)
+{
+	sched_flood_ev_t *fevs;
+	scheduler_stats_t before, after;
+	int i, ret = -1;
+
+	if ((fevs = calloc(SCHED_FLOOD_EVENTS, sizeof(*fevs))) == NULL)
+		return -1;
+	scheduler_stats(&before);
+	for (i = 0; i < SCHED_FLOOD_EVENTS; i++) {
+		sched_flood_ev_t *fev = &fevs[i];
+
+		INIT_LIST_HEAD(&fev->rx_queue);
+		INIT_LIST_HEAD(&fev->rx_item);
+		event_init(&fev->event);
+		event_register(&fev->event, EV_READ, &fev->rx_queue,
+			       sched_flood_ev_cb);
+	}
+	for (i = 0; i < SCHED_FLOOD_EVENTS; i++) {
+		sched_flood_ev_t *fev = &fevs[i];
+
+		list_add_tail(&fev->rx_item, &fev->rx_queue);
+		event_schedule_event(&fev->event, EV_READ);
+	}
+	scheduler_drain();
+	scheduler_stats(&after);
+
+	for (i = 0; i < SCHED_FLOOD_EVENTS; i++) {
+		if (fevs[i].calls != 1) {
+			fprintf(stderr, "%s: event %d called %d times\n",
+				__func__, i, fevs[i].calls);
+			goto end;
+		}
+	}
+	if (after.overflowed == before.overflowed
+	    || after.dropped != before.dropped)
+		goto end;
+	printf("scheduler flood: %d events, %u overflowed, %u dropped\n",
+	       SCHED_FLOOD_EVENTS, after.overflowed - before.overflowed,
+	       after.dropped - before.dropped);
+	ret = 0;
+ end:
+	for (i = 0; i < SCHED_FLOOD_EVENTS; i++)
+		event_unregister(&fevs[i].event);
+	free(fevs);
+	return ret;
+}
+
+#define SCHED_BURST_PKTS 16
+
+static int sched_burst_calls;
+
+static void sched_burst_ev_cb(event_t *ev, uint8_t events)
+{
+	list_t *item, *tmp;
+
+	/* like a socket reader, drain the whole rx queue */
+	list_for_each_safe(item, tmp, ev->rx_queue)
+		list_del_init(item);
+	sched_burst_calls++;
+}
+
+/* a burst of packets for one socket is handled by a single task */
+static int scheduler_coalesce_check(void)
+{
+	event_t ev;
+	list_t rx_queue;
+	list_t items[SCHED_BURST_PKTS];
+	int i, tasks;
+
+	INIT_LIST_HEAD(&rx_queue);
+	event_init(&ev);
+	event_register(&ev, EV_READ, &rx_queue, sched_burst_ev_cb);
+	for (i = 0; i < SCHED_BURST_PKTS; i++) {
+		list_add_tail(&items[i], &rx_queue);
+		event_schedule_event(&ev, EV_READ);
+	}
+	tasks = scheduler_run_tasks(SCHED_BURST_PKTS * 2);
+	event_unregister(&ev);
+	if (tasks != 1 || sched_burst_calls != 1 || scheduler_has_tasks())
+		return -1;
+	printf("scheduler coalescing: %d packets, %d task\n",
+	       SCHED_BURST_PKTS, tasks);
+	return 0;
+}
+#endif
+
+static int sched_cancel_runs;
+
+static void sched_cancel_cb(void *arg)
+{
+	if (arg)
+		sched_cancel_runs++;
+}
+
+/* a cancelled task does not run, wherever it waits */
+static int scheduler_cancel_check(void)
+{
+	scheduler_stats_t before, after;
+	sched_task_t task, other;
+
+	scheduler_drain();
+	sched_cancel_runs = 0;
+	sched_task_init(&task, sched_cancel_cb, &task);
+	sched_task_init(&other, sched_cancel_cb, &other);
+
+	/* in a task queue */
+	schedule_embedded_task(&task, SCHEDULER_PRIO_NORMAL);
+	schedule_embedded_task(&other, SCHEDULER_PRIO_NORMAL);
+	scheduler_cancel_task(&task);
+	scheduler_drain();
+	if (sched_cancel_runs != 1)
+		return -1;
+
+	/* on the overflow list */
+	scheduler_stats(&before);
+	do {
+		schedule_task(sched_cancel_cb, NULL);
+		scheduler_stats(&after);
+	} while (after.dropped == before.dropped);
+	schedule_embedded_task(&task, SCHEDULER_PRIO_NORMAL);
+	scheduler_stats(&after);
+	if (after.overflowed == before.overflowed)
+		return -1;
+	scheduler_cancel_task(&task);
+	scheduler_drain();
+	return sched_cancel_runs == 1 ? 0 : -1;
+}
+
+#if CONFIG_SCHEDULER_CPUS > 1
+#define SCHED_CPU_TASKS 20000
+
+static unsigned sched_cpu_last[CONFIG_SCHEDULER_CPUS];
+static unsigned sched_cpu_errors;
+static unsigned sched_cpu_runs;
+static unsigned sched_cpu_done;
+
+/* run on cpu 0, in order for each sender */
+static void sched_cpu_cb(void *arg)
+{
+	uintptr_t v = (uintptr_t)arg;
+	unsigned from = v >> 24;
+	unsigned seq = v & 0xFFFFFF;
+
+	if (scheduler_cpu() != 0 || seq != sched_cpu_last[from] + 1)
+		sched_cpu_errors++;
+	sched_cpu_last[from] = seq;
+	sched_cpu_runs++;
+}
+
+static void sched_cpu_self_cb(void *arg)
+{
+	if (scheduler_cpu() == *(uint8_t *)arg)
+		*(uint8_t *)arg = 0;
+}
+
+static void *__sched_cpu_worker(void *arg)
+{
+	uint8_t cpu = (uintptr_t)arg;
+	uint8_t self = cpu;
+	sigset_t set;
+	unsigned i;
+
+	/* timers run on cpu 0 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (scheduler_set_cpu(cpu) < 0)
+		return NULL;
+
+	/* a worker only runs the tasks sent to it */
+	if (schedule_task_on(cpu, sched_cpu_self_cb, &self) < 0
+	    || scheduler_run_tasks(SCHED_CPU_TASKS) != 1 || self
+	    || scheduler_has_tasks())
+		return NULL;
+	for (i = 1; i <= SCHED_CPU_TASKS; i++) {
+		void *a = (void *)(((uintptr_t)cpu << 24) | i);
+
+		while (schedule_task_on(0, sched_cpu_cb, a) < 0)
+			sched_yield();
+	}
+	return arg;
+}
+
+static void *sched_cpu_worker(void *arg)
+{
+	void *ret = __sched_cpu_worker(arg);
+
+	__sync_add_and_fetch(&sched_cpu_done, 1);
+	return ret;
+}
+
+/* every other cpu sends tasks to cpu 0 */
+static int scheduler_cpus_check(void)
+{
+	pthread_t threads[CONFIG_SCHEDULER_CPUS];
+	unsigned total = (CONFIG_SCHEDULER_CPUS - 1) * SCHED_CPU_TASKS;
+	uint64_t start, cycles;
+	void *ret;
+	int cpu, err = 0;
+
+	scheduler_drain();
+	start = __rdtsc();
+	for (cpu = 1; cpu < CONFIG_SCHEDULER_CPUS; cpu++)
+		if (pthread_create(&threads[cpu], NULL, sched_cpu_worker,
+				   (void *)(uintptr_t)cpu))
+			return -1;
+	while (__atomic_load_n(&sched_cpu_done, __ATOMIC_ACQUIRE)
+	       < CONFIG_SCHEDULER_CPUS - 1)
+		if (scheduler_run_tasks(64) == 0)
+			sched_yield();
+	scheduler_drain();
+	cycles = __rdtsc() - start;
+	for (cpu = 1; cpu < CONFIG_SCHEDULER_CPUS; cpu++) {
+		pthread_join(threads[cpu], &ret);
+		if (ret != (void *)(uintptr_t)cpu)
+			err = -1;
+	}
+	if (err < 0 || sched_cpu_errors || sched_cpu_runs != total
+	    || schedule_task_on(CONFIG_SCHEDULER_CPUS, sched_cpu_cb, NULL) >= 0)
+		return -1;
+	printf("scheduler cpus: %u remote tasks, %lu cycles per task\n",
+	       total, (unsigned long)(cycles / total));
+	return 0;
+}
+#endif
+
+static int scheduler_check(void)
+{
+	int i;
+
+	scheduler_drain();
+
+	/* strict priority */
+	schedule_task_prio(sched_order_cb, (void *)'l', SCHEDULER_PRIO_LOW);
+	schedule_task(sched_order_cb, (void *)'n');
+	schedule_task_prio(sched_order_cb, (void *)'h', SCHEDULER_PRIO_HIGH);
+	scheduler_drain();
+	if (CONFIG_SCHEDULER_PRIO_NB == 3 && memcmp(sched_order, "hnl", 3))
+		return -1;
+
+	/* a low priority task is not starved by a busy high priority one */
+	sched_order_len = 0;
+	sched_high_busy = 1;
+	schedule_task_prio(sched_high_cb, NULL, SCHEDULER_PRIO_HIGH);
+	schedule_task_prio(sched_order_cb, (void *)'l', SCHEDULER_PRIO_LOW);
+	for (i = 0; i < 32 && sched_order_len == 0; i++)
+		scheduler_run_task();
+	if (sched_order_len != 1 || sched_high_runs == 0)
+		return -1;
+	printf("scheduler: low priority task run after %d high priority "
+	       "tasks\n", sched_high_runs);
+
+	sched_high_busy = 0;
+	scheduler_drain();
+
+	for (i = 0; i < 5; i++)
+		schedule_task(sched_order_cb, NULL);
+	if (scheduler_high_water_mark(SCHEDULER_PRIO_NORMAL, !IRQ_CHECK()) < 5)
+		return -1;
+
+	/* budgeted runs */
+	if (scheduler_run_tasks(3) != 3 || scheduler_run_tasks(10) != 2
+	    || scheduler_has_tasks())
+		return -1;
+	sched_high_busy = 1;
+	schedule_task_prio(sched_high_cb, NULL, SCHEDULER_PRIO_HIGH);
+	if (scheduler_run_tasks(10) != 10)
+		return -1;
+	sched_high_busy = 0;
+	scheduler_drain();
+#ifdef CONFIG_EVENT
+	if (scheduler_flood_check() < 0 || scheduler_coalesce_check() < 0)
+		return -1;
+#endif
+	if (scheduler_cancel_check() < 0)
+		return -1;
+#if CONFIG_SCHEDULER_CPUS > 1
+	if (scheduler_cpus_check() < 0)
+		return -1;
+#endif
+	return 0;
+}
+
 static int send(iface_t *iface, pkt_t *pkt)
 {
 	return 0;
@@ -565,6 +1492,16 @@ int main(int argc, char **argv)
 		return -1;
 	}
 	printf("  ==> ring checks succeeded\n");
+	if (ring_span_check() < 0) {
+		fprintf(stderr, "  ==> ring span checks failed\n");
+		return -1;
+	}
+	printf("  ==> ring span checks succeeded\n");
+	if (ring_mp_check() < 0) {
+		fprintf(stderr, "  ==> multi producer ring checks failed\n");
+		return -1;
+	}
+	printf("  ==> multi producer ring checks succeeded\n");
 	if (list_check() < 0) {
 		fprintf(stderr, "  ==> double linked list checks failed\n");
 		return -1;
@@ -577,24 +1514,41 @@ int main(int argc, char **argv)
 	}
 	printf("  ==> singly linked list checks succeeded\n");
 
-#ifdef CONFIG_HT_STORAGE
 	if (htable_check(1024) < 0) {
 		fprintf(stderr, "  ==> htable checks failed (htable size: 1024)\n");
 		return -1;
 	}
+#ifdef CONFIG_HT_OPEN_ADDRESSING
+	/* open addressing tables can't hold more entries than slots */
+	if (htable_check(8) < 0) {
+		fprintf(stderr, "  ==> htable checks failed (htable size: 8)\n");
+		return -1;
+	}
+#else
 	if (htable_check(4) < 0) {
 		fprintf(stderr, "  ==> htable checks failed (htable size: 4)\n");
 		return -1;
 	}
+#endif
 
 	printf("  ==> htable checks succeeded\n");
-#endif
+	if (cksum_check() < 0) {
+		fprintf(stderr, "  ==> checksum checks failed\n");
+		return -1;
+	}
+	printf("  ==> checksum checks succeeded\n");
 	if (timer_check() < 0) {
 		fprintf(stderr, "  ==> timer checks failed\n");
 		return -1;
 	}
 	printf("  ==> timer checks succeeded\n");
 
+	if (scheduler_check() < 0) {
+		fprintf(stderr, "  ==> scheduler checks failed\n");
+		return -1;
+	}
+	printf("  ==> scheduler checks succeeded\n");
+
 	if (driver_rf_checks() < 0) {
 		fprintf(stderr, "  ==> driver RF tests failed\n");
 		return -1;
@@ -622,11 +1576,57 @@ int main(int argc, char **argv)
 	}
 	printf("  ==> net swen-l3 tests succeeded\n");
 #endif
+	if (net_pkt_mempool_tests() < 0) {
+		fprintf(stderr, "  ==> net packet pool tests failed\n");
+		return -1;
+	}
+	printf("  ==> net packet pool tests succeeded\n");
+	if (net_pkt_class_tests() < 0) {
+		fprintf(stderr, "  ==> net packet size class tests failed\n");
+		return -1;
+	}
+	printf("  ==> net packet size class tests succeeded\n");
+	if (net_pkt_chain_tests() < 0) {
+		fprintf(stderr, "  ==> net packet chain tests failed\n");
+		return -1;
+	}
+	printf("  ==> net packet chain tests succeeded\n");
 	if (net_arp_tests() < 0) {
 		fprintf(stderr, "  ==> net arp tests failed\n");
 		return -1;
 	}
 	printf("  ==> net arp tests succeeded\n");
+#ifdef CONFIG_ARP_HASH
+	if (net_arp_cache_tests() < 0) {
+		fprintf(stderr, "  ==> net arp cache tests failed\n");
+		return -1;
+	}
+	printf("  ==> net arp cache tests succeeded\n");
+#endif
+	if (net_arp_resolve_tests() < 0) {
+		fprintf(stderr, "  ==> net arp resolve tests failed\n");
+		return -1;
+	}
+	printf("  ==> net arp resolve tests succeeded\n");
+	if (net_ip_proto_tests() < 0) {
+		fprintf(stderr, "  ==> net ip protocol tests failed\n");
+		return -1;
+	}
+	printf("  ==> net ip protocol tests succeeded\n");
+#ifdef CONFIG_IP_FRAG
+	if (net_ip_frag_tests() < 0) {
+		fprintf(stderr, "  ==> net ip fragmentation tests failed\n");
+		return -1;
+	}
+	printf("  ==> net ip fragmentation tests succeeded\n");
+#endif
+#ifdef CONFIG_IP_FORWARD
+	if (net_ip_forward_tests() < 0) {
+		fprintf(stderr, "  ==> net ip forwarding tests failed\n");
+		return -1;
+	}
+	printf("  ==> net ip forwarding tests succeeded\n");
+#endif
 
 #ifdef CONFIG_ICMP
 	if (net_icmp_tests() < 0) {
@@ -648,6 +1648,42 @@ int main(int argc, char **argv)
 		return -1;
 	}
 	printf("  ==> net tcp tests succeeded\n");
+	if (net_tcp_throughput_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp throughput tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp throughput tests succeeded\n");
+#if CONFIG_TCP_OOO_MAX_PKTS > 0 && !defined(CONFIG_BSD_COMPAT)
+	if (net_tcp_ooo_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp out of order tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp out of order tests succeeded\n");
+#endif
+#if defined(CONFIG_TCP_RETRANSMIT) && !defined(CONFIG_BSD_COMPAT)
+	if (net_tcp_rto_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp rto tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp rto tests succeeded\n");
+#endif
+#ifndef CONFIG_BSD_COMPAT
+	if (net_tcp_segmentation_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp segmentation tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp segmentation tests succeeded\n");
+	if (net_tcp_passive_close_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp passive close tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp passive close tests succeeded\n");
+#endif
+	if (net_tcp_conn_lookup_tests() < 0) {
+		fprintf(stderr, "  ==> net tcp connection lookup tests failed\n");
+		return -1;
+	}
+	printf("  ==> net tcp connection lookup tests succeeded\n");
 #endif
 	return 0;
 }
@@ -22,11 +22,14 @@
  *
 */
 
+#define _GNU_SOURCE /* ppoll() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -49,6 +52,37 @@ static uint8_t ip_mask[] = { 255, 255, 255, 0 };
 static uint8_t mac[] = { 0x54, 0x52, 0x00, 0x02, 0x00, 0x41 };
 static struct pollfd tun_fds[1];
 
+/* maximum number of tasks run per wakeup */
+#define TUN_TASK_BUDGET 64
+
+static struct {
+	unsigned long wakeups;
+	unsigned long tasks;
+	unsigned max_tasks;
+} sched_stats;
+static volatile sig_atomic_t sched_stats_dump;
+
+static void sched_stats_sig(int signo)
+{
+	(void)signo;
+	sched_stats_dump = 1;
+}
+
+static void sched_stats_update(int tasks)
+{
+	sched_stats.wakeups++;
+	sched_stats.tasks += tasks;
+	if (tasks > sched_stats.max_tasks)
+		sched_stats.max_tasks = tasks;
+	if (!sched_stats_dump)
+		return;
+	sched_stats_dump = 0;
+	printf("wakeups: %lu tasks: %lu (%.2f per wakeup, max: %u)\n",
+	       sched_stats.wakeups, sched_stats.tasks,
+	       (double)sched_stats.tasks / sched_stats.wakeups,
+	       sched_stats.max_tasks);
+}
+
 static int send(iface_t *iface, pkt_t *pkt);
 static void recv(iface_t *iface) {}
 
@@ -62,8 +96,8 @@ static iface_t iface = {
 };
 
 static struct iface_queues {
-	RING_DECL_IN_STRUCT(rx, CONFIG_PKT_NB_MAX);
-	RING_DECL_IN_STRUCT(tx, CONFIG_PKT_NB_MAX);
+	RING_DECL_IN_STRUCT(rx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
+	RING_DECL_IN_STRUCT(tx, PKT_RING_SIZE(CONFIG_PKT_NB_MAX));
 } iface_queues = {
 	.rx = RING_INIT(iface_queues.rx),
 	.tx = RING_INIT(iface_queues.tx),
@@ -85,13 +119,39 @@ static int send(iface_t *iface, pkt_t *pkt)
 	return 0;
 }
 
+#ifdef CONFIG_TIMER_TICKLESS
+/* sleep until a packet is received or the next timer expires */
+static int tun_poll(void)
+{
+	struct timespec ts, *timeout = NULL;
+	int64_t us = timer_tickless_timeout();
+	int ret;
+
+	if (scheduler_has_tasks())
+		us = 0;
+	if (us >= 0) {
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		timeout = &ts;
+	}
+	ret = ppoll(tun_fds, 1, timeout, NULL);
+	timer_tickless_process();
+	return ret;
+}
+#else
+static int tun_poll(void)
+{
+	return poll(tun_fds, 1, -1);
+}
+#endif
+
 static int tun_receive_pkt(const iface_t *iface)
 {
 	pkt_t *pkt;
 	uint8_t buf[2048];
 	ssize_t nread;
 
-	if (poll(tun_fds, 1, -1) < 0) {
+	if (tun_poll() < 0) {
 		if (errno == EINTR)
 			return -1;
 		fprintf(stderr, "cannot poll on tun fd (%m (%d))\n", errno);
@@ -200,11 +260,14 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 #endif
+	/* kill -USR1 prints the scheduler statistics */
+	signal(SIGUSR1, sched_stats_sig);
+
 	while (1) {
 		if (tun_receive_pkt(&iface) >= 0)
 			iface.if_input(&iface);
 
-		scheduler_run_task();
+		sched_stats_update(scheduler_run_tasks(TUN_TASK_BUDGET));
 #if defined(CONFIG_TCP) && !defined(CONFIG_EVENT)
 		udp_app();
 #endif
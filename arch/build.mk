@@ -70,11 +70,13 @@ endif
 CFLAGS += -I$(ARCH_DIR)/$(ARCH)
 
 # Do not use a too small timer resolution on x86 in order
-# not to have a busy CPU.
+# not to have a busy CPU. Tickless mode does not tick when idle.
 ifeq ($(CONFIG_ARCH),X86_TUN_TAP)
+ifndef CONFIG_TIMER_TICKLESS
 ifeq ($(shell test $(CONFIG_TIMER_RESOLUTION_US) -lt 1000; echo $$?),0)
 CONFIG_TIMER_RESOLUTION_US=1000
 endif
 endif
+endif
 
 CFLAGS += -DCONFIG_TIMER_RESOLUTION_US=$(CONFIG_TIMER_RESOLUTION_US)
@@ -28,16 +28,26 @@
 
 extern uint8_t irq_lock;
 
+/* timer ticks received while interrupts were disabled */
+extern volatile uint16_t irq_pending_ticks;
+void __irq_process_pending_ticks(void);
+
 #define irq_disable() irq_lock = 1
-#define irq_enable() irq_lock = 0
+#define irq_enable() do {				\
+		irq_lock = 0;				\
+		if (irq_pending_ticks)			\
+			__irq_process_pending_ticks();	\
+	} while (0)
 
 #define irq_save(flags) do {			\
 		flags = irq_lock;		\
 		irq_disable();			\
 	} while (0)
 
-#define irq_restore(flags) do {			\
-		irq_lock = flags;		\
+#define irq_restore(flags) do {					\
+		irq_lock = flags;				\
+		if (irq_lock == 0 && irq_pending_ticks)		\
+			__irq_process_pending_ticks();		\
 	} while (0)
 
 #define IRQ_CHECK() 0
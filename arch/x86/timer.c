@@ -27,18 +27,102 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <string.h>
 #include <sys/timer.h>
 
 #include "timer.h"
+#include "interrupts.h"
 
 uint8_t irq_lock;
+volatile uint16_t irq_pending_ticks;
+timer_tick_stats_t timer_tick_stats;
+
+/* run the ticks deferred by an irq_save() section */
+void __irq_process_pending_ticks(void)
+{
+	uint16_t pending;
+
+	do {
+		irq_lock = 1;
+		/* a tick may be deferred between reading and clearing */
+		while ((pending = __atomic_exchange_n(&irq_pending_ticks, 0,
+						      __ATOMIC_SEQ_CST))) {
+			if (pending > timer_tick_stats.max_deferred)
+				timer_tick_stats.max_deferred = pending;
+			while (pending--)
+				timer_process();
+		}
+		irq_lock = 0;
+	} while (irq_pending_ticks);
+}
+
+#ifdef CONFIG_TIMER_TICKLESS
+static uint64_t tickless_base_us;
+/* clock tick of the last timer_tickless_process() call */
+static uint32_t tickless_last;
+
+static uint64_t timer_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void timer_tickless_process(void)
+{
+	uint32_t now = (timer_now_us() - tickless_base_us)
+		/ CONFIG_TIMER_RESOLUTION_US;
+
+	if (now == tickless_last)
+		return;
+	/* the wheel catches up with the skipped ticks */
+	timer_ticks += now - tickless_last - 1;
+	tickless_last = now;
+	timer_process();
+}
+
+int64_t timer_tickless_timeout(void)
+{
+	uint64_t elapsed = timer_now_us() - tickless_base_us;
+	uint32_t lag = (uint32_t)(elapsed / CONFIG_TIMER_RESOLUTION_US)
+		- tickless_last;
+	int32_t ticks = timer_next_expiry();
+
+	if (ticks < 0)
+		return -1;
+	if ((uint32_t)ticks <= lag)
+		return 0;
+	return (uint64_t)(ticks - lag) * CONFIG_TIMER_RESOLUTION_US
+		- elapsed % CONFIG_TIMER_RESOLUTION_US;
+}
+
+void __timer_subsystem_init(void)
+{
+	tickless_base_us = timer_now_us();
+	tickless_last = 0;
+}
+
+void __timer_subsystem_stop(void) {}
+#else
 
 static inline void process_timers(int signo)
 {
 	(void)signo;
-	if (!irq_lock)
-		timer_process();
+	if (irq_lock) {
+		if (irq_pending_ticks == UINT16_MAX) {
+			timer_tick_stats.lost++;
+			return;
+		}
+		irq_pending_ticks++;
+		timer_tick_stats.deferred++;
+		return;
+	}
+	/* like a hardware interrupt, don't nest with irq_restore() */
+	irq_lock = 1;
+	timer_process();
+	irq_lock = 0;
 }
 
 void __timer_subsystem_init(void)
@@ -77,3 +161,4 @@ void __timer_subsystem_stop(void)
 	if (setitimer(ITIMER_REAL, &timer, NULL) < 0)
 		fprintf(stderr, "\n can'\t disable itimer (%m)\n");
 }
+#endif
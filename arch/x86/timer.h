@@ -27,6 +27,34 @@
 
 #include <stdint.h>
 
+/** Timer tick statistics
+ *
+ * Ticks received in an irq_save() section are deferred until
+ * interrupts are restored.
+ */
+typedef struct timer_tick_stats {
+	uint32_t deferred;     /* ticks run late */
+	uint32_t lost;         /* ticks dropped, pending counter full */
+	uint16_t max_deferred; /* largest number of ticks run late at once */
+} timer_tick_stats_t;
+
+extern timer_tick_stats_t timer_tick_stats;
+
+#ifdef CONFIG_TIMER_TICKLESS
+/** Run the timers expired since the last call
+ *
+ * In tickless mode, there is no timer interrupt. This function should
+ * be called from the main loop after each wakeup.
+ */
+void timer_tickless_process(void);
+
+/** Get the time left before the next timer expiry
+ *
+ * @return number of microseconds, -1 if no timer is pending
+ */
+int64_t timer_tickless_timeout(void);
+#endif
+
 void __timer_subsystem_init(void);
 void __timer_subsystem_stop(void);
 static inline void __timer_subsystem_start(void)
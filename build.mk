@@ -27,6 +27,17 @@ SRC += $(ROOT_PATH)/sys/scheduler.c
 ifdef CONFIG_SCHEDULER_TASK_WATER_MARK
 CFLAGS += -DCONFIG_SCHEDULER_TASK_WATER_MARK=$(CONFIG_SCHEDULER_TASK_WATER_MARK)
 endif
+ifdef CONFIG_SCHEDULER_PRIO_NB
+CFLAGS += -DCONFIG_SCHEDULER_PRIO_NB=$(CONFIG_SCHEDULER_PRIO_NB)
+endif
+ifdef CONFIG_SCHEDULER_AGING
+CFLAGS += -DCONFIG_SCHEDULER_AGING=$(CONFIG_SCHEDULER_AGING)
+endif
+endif
+
+ifdef CONFIG_SCHEDULER_CPUS
+CFLAGS += -DCONFIG_SCHEDULER_CPUS=$(CONFIG_SCHEDULER_CPUS) -pthread
+LDFLAGS += -pthread
 endif
 
 ifdef CONFIG_USART0
@@ -47,6 +58,16 @@ CFLAGS += -DCONFIG_USART1_SPEED=57600
 endif
 endif
 
+ifdef CONFIG_HT_OPEN_ADDRESSING
+CFLAGS += -DCONFIG_HT_OPEN_ADDRESSING
+ifdef CONFIG_HT_KEY_SIZE
+CFLAGS += -DCONFIG_HT_KEY_SIZE=$(CONFIG_HT_KEY_SIZE)
+endif
+ifdef CONFIG_HT_VAL_SIZE
+CFLAGS += -DCONFIG_HT_VAL_SIZE=$(CONFIG_HT_VAL_SIZE)
+endif
+endif
+
 ifdef CONFIG_RND_SEED
 CFLAGS += -DCONFIG_RND_SEED
 SRC += $(ROOT_PATH)/sys/random.c
@@ -84,6 +105,18 @@ ifdef CONFIG_TIMER_CHECKS
 CFLAGS += -DCONFIG_TIMER_CHECKS
 endif
 
+ifdef CONFIG_TIMER_TICKLESS
+CFLAGS += -DCONFIG_TIMER_TICKLESS
+endif
+
+ifdef CONFIG_TIMER_WHEEL_BITS
+CFLAGS += -DCONFIG_TIMER_WHEEL_BITS=$(CONFIG_TIMER_WHEEL_BITS)
+endif
+
+ifdef CONFIG_TIMER_WHEEL_LEVELS
+CFLAGS += -DCONFIG_TIMER_WHEEL_LEVELS=$(CONFIG_TIMER_WHEEL_LEVELS)
+endif
+
 ifdef CONFIG_TIMER_RESOLUTION_US
 CFLAGS += -DCONFIG_TIMER_RESOLUTION_US=$(CONFIG_TIMER_RESOLUTION_US)
 SRC += $(ROOT_PATH)/sys/timer.c $(ARCH_DIR)/$(ARCH)/timer.c
@@ -93,10 +126,26 @@ ifdef CONFIG_ETHERNET
 CFLAGS += -DCONFIG_ETHERNET
 endif
 
+ifdef CONFIG_ARP_HASH
+CFLAGS += -DCONFIG_ARP_HASH
+endif
+
 ifdef CONFIG_IP
 CFLAGS += -DCONFIG_IP
 endif
 
+ifdef CONFIG_IP_FRAG
+CFLAGS += -DCONFIG_IP_FRAG
+endif
+
+ifdef CONFIG_IP_FORWARD
+CFLAGS += -DCONFIG_IP_FORWARD
+endif
+
+ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+CFLAGS += -DCONFIG_MORE_THAN_ONE_INTERFACE
+endif
+
 ifdef CONFIG_UDP
 CFLAGS += -DCONFIG_UDP
 endif
@@ -110,6 +159,15 @@ CFLAGS += -DCONFIG_TCP
 ifdef CONFIG_TCP_CLIENT
 CFLAGS += -DCONFIG_TCP_CLIENT
 endif
+ifdef CONFIG_TCP_OOO_MAX_PKTS
+CFLAGS += -DCONFIG_TCP_OOO_MAX_PKTS=$(CONFIG_TCP_OOO_MAX_PKTS)
+endif
+ifdef CONFIG_TCP_SND_QUEUE_MAX
+CFLAGS += -DCONFIG_TCP_SND_QUEUE_MAX=$(CONFIG_TCP_SND_QUEUE_MAX)
+endif
+ifdef CONFIG_TCP_RETRANSMIT
+CFLAGS += -DCONFIG_TCP_RETRANSMIT
+endif
 endif
 
 ifdef CONFIG_BSD_COMPAT
@@ -133,6 +191,17 @@ ifdef CONFIG_PKT_NB_MAX
 CFLAGS += -DCONFIG_PKT_NB_MAX=$(CONFIG_PKT_NB_MAX)
 CFLAGS += -DCONFIG_PKT_SIZE=$(CONFIG_PKT_SIZE)
 CFLAGS += -DCONFIG_PKT_DRIVER_NB_MAX=$(CONFIG_PKT_DRIVER_NB_MAX)
+ifdef CONFIG_PKT_IDX_WIDTH
+CFLAGS += -DCONFIG_PKT_IDX_WIDTH=$(CONFIG_PKT_IDX_WIDTH)
+endif
+ifdef CONFIG_PKT_SMALL_NB_MAX
+CFLAGS += -DCONFIG_PKT_SMALL_NB_MAX=$(CONFIG_PKT_SMALL_NB_MAX)
+CFLAGS += -DCONFIG_PKT_SMALL_SIZE=$(CONFIG_PKT_SMALL_SIZE)
+endif
+ifdef CONFIG_PKT_MEDIUM_NB_MAX
+CFLAGS += -DCONFIG_PKT_MEDIUM_NB_MAX=$(CONFIG_PKT_MEDIUM_NB_MAX)
+CFLAGS += -DCONFIG_PKT_MEDIUM_SIZE=$(CONFIG_PKT_MEDIUM_SIZE)
+endif
 endif
 
 ifdef CONFIG_SWEN_L3
@@ -193,7 +193,7 @@ void tcp_app(void)
 {
 	uint32_t src_addr;
 	uint16_t src_port;
-	int i;
+	int i, sent;
 
 	for (i = 0; i < TCP_CLIENTS; i++) {
 		if (ctx[i].sock_info.trq.tcp_conn == NULL) {
@@ -217,7 +217,8 @@ void tcp_app(void)
 				goto reset_sb;
 			}
 		}
-		if (__socket_put_sbuf(&ctx[i].sock_info, &ctx[i].sb, 0, 0) < 0) {
+		sent = __socket_put_sbuf(&ctx[i].sock_info, &ctx[i].sb, 0, 0);
+		if (sent < 0) {
 			DEBUG_LOG("cannot put sbuf to socket (len:%d) (from pkt:%p)\n",
 				  ctx[i].sb.len, ctx[i].pkt);
 			if (sock_info_state(&ctx[i].sock_info) != SOCK_CONNECTED) {
@@ -226,6 +227,12 @@ void tcp_app(void)
 			}
 			continue;
 		}
+		/* send the rest on the next pass */
+		if (sent < ctx[i].sb.len) {
+			sbuf_init(&ctx[i].sb, ctx[i].sb.data + sent,
+				  ctx[i].sb.len - sent);
+			continue;
+		}
 	reset_sb:
 		if (ctx[i].sb.len) {
 			sbuf_reset(&ctx[i].sb);
@@ -265,11 +272,18 @@ static void ev_clients_cb(event_t *ev, uint8_t events)
 	}
 
 	if (events & EV_WRITE) {
-		if (__socket_put_sbuf(&ctx->sock_info, &ctx->sb, 0,
-				      0) < 0) {
+		int sent = __socket_put_sbuf(&ctx->sock_info, &ctx->sb, 0, 0);
+
+		if (sent < 0) {
 			LOG("%s:%d write failed\n", __func__, __LINE__);
 			return;
 		}
+		/* wait for the next EV_WRITE to send the rest */
+		if (sent < ctx->sb.len) {
+			sbuf_init(&ctx->sb, ctx->sb.data + sent,
+				  ctx->sb.len - sent);
+			return;
+		}
 		pkt_free(ctx->pkt);
 		sbuf_reset(&ctx->sb);
 		socket_event_set_mask(&ctx->sock_info, EV_READ);
@@ -77,7 +77,7 @@ void udp_client_cb(void *arg)
 
 		s[sb.len] = 0;
 		DEBUG_LOG("%s", s);
-		pkt_free(pkt);
+		pkt_chain_free(pkt);
 	}
 	timer_reschedule(&udp_client_timer, UDP_CLIENT_SEND_DELAY);
 }
@@ -127,6 +127,6 @@ void udp_app(void)
 
 		if (socket_put_sbuf(udp_fd, &sb, &addr) < 0)
 			DEBUG_LOG("can't put sbuf to socket\n");
-		pkt_free(pkt);
+		pkt_chain_free(pkt);
 	}
 }
@@ -61,7 +61,7 @@ static void udp_get_pkt(sock_info_t *sock_info)
 		src_port = ntohs(src_port);
 		DEBUG_LOG("got from 0x%X on port %u: %.*s\n", src_addr,
 			  src_port, sb.len, sb.data);
-		pkt_free(pkt);
+		pkt_chain_free(pkt);
 	}
 }
 
@@ -110,7 +110,7 @@ static void udp_client_send_buf_cb(void *arg)
 
 		s[sb.len] = '\0';
 		DEBUG_LOG("%s", s);
-		pkt_free(pkt);
+		pkt_chain_free(pkt);
 	}
 	timer_reschedule(&udp_client_timer, UDP_CLIENT_SEND_DELAY);
 }
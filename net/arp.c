@@ -25,6 +25,7 @@
 #include "arp.h"
 #include "eth.h"
 #include "ip.h"
+#include "route.h"
 #include <sys/timer.h>
 
 static arp_entries_t arp_entries;
@@ -36,58 +37,249 @@ uint8_t broadcast_mac[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
 #define ARP_RETRY_TIMEOUT 3 /* seconds */
 #define ARP_RETRIES 2
+/* unicast requests confirming a used entry before it expires */
+#define ARP_PROBES 3
+#define ARP_PKT_SIZE (int)(sizeof(eth_hdr_t) + sizeof(arp_hdr_t) \
+			   + ETHER_ADDR_LEN * 2 + IP_ADDR_LEN * 2)
 
+/* pending resolution, packets wait for the destination MAC address */
 struct arp_res {
-	list_t list;
 	list_t pkt_list;
 	tim_t tim;
-	iface_t *iface;
+	iface_t *iface; /* NULL if the slot is free */
+	uint32_t ip;
 	uint8_t retries;
+	uint8_t nb_pkts;
 } __PACKED__;
 typedef struct arp_res arp_res_t;
 
-static list_t arp_wait_list = LIST_HEAD_INIT(arp_wait_list);
+static arp_res_t arp_res_slots[CONFIG_ARP_RES_SLOTS];
+static arp_stats_t arp_drop_stats;
+
+static inline void
+arp_entry_set(arp_entry_t *e, const uint8_t *sha, const iface_t *iface)
+{
+	memcpy(e->mac, sha, ETHER_ADDR_LEN);
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	e->iface = (iface_t *)iface;
+#else
+	(void)iface;
+#endif
+#ifdef CONFIG_ARP_EXPIRY
+	e->age = 0;
+	e->used = 0;
+#endif
+}
+
+static inline void arp_entry_get(arp_entry_t *e, const uint8_t **mac,
+				 iface_t **iface)
+{
+#ifdef CONFIG_ARP_EXPIRY
+	e->used = 1;
+#endif
+	*mac = e->mac;
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	*iface = e->iface;
+#else
+	(void)iface;
+#endif
+}
+
+#ifdef CONFIG_ARP_HASH
+static inline uint16_t arp_hash(uint32_t ip)
+{
+	ip ^= ip >> 16;
+	ip ^= ip >> 8;
+	return ip & (ARP_HASH_SIZE - 1);
+}
+
+static arp_entry_t *arp_lookup(uint32_t ip)
+{
+	uint16_t idx = arp_entries.buckets[arp_hash(ip)];
+
+	while (idx) {
+		arp_entry_t *e = &arp_entries.entries[idx - 1];
+
+		if (e->ip == ip)
+			return e;
+		idx = e->next;
+	}
+	return NULL;
+}
+
+static void arp_unlink(arp_entry_t *e)
+{
+	uint16_t *idx = &arp_entries.buckets[arp_hash(e->ip)];
+	uint16_t e_idx = e - arp_entries.entries + 1;
+
+	while (*idx != e_idx) {
+		if (*idx == 0)
+			return;
+		idx = &arp_entries.entries[*idx - 1].next;
+	}
+	*idx = e->next;
+	e->next = 0;
+}
+
+static void arp_del_entry(arp_entry_t *e)
+{
+	arp_unlink(e);
+	e->ip = 0;
+	/* reused first */
+	list_move(&e->lru, &arp_entries.lru);
+}
 
 int
 arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t **iface)
+{
+	arp_entry_t *e = arp_lookup(*ip);
+
+	if (e == NULL)
+		return -1;
+	list_move_tail(&e->lru, &arp_entries.lru);
+	arp_entry_get(e, mac, iface);
+	return 0;
+}
+
+static arp_entry_t *arp_alloc_entry(void)
+{
+	arp_entry_t *e;
+
+	if (arp_entries.lru.next == NULL)
+		INIT_LIST_HEAD(&arp_entries.lru);
+	if (arp_entries.nb < CONFIG_ARP_TABLE_SIZE) {
+		e = &arp_entries.entries[arp_entries.nb++];
+		list_add_tail(&e->lru, &arp_entries.lru);
+		return e;
+	}
+	/* evict the least recently used entry */
+	e = list_first_entry(&arp_entries.lru, arp_entry_t, lru);
+	if (e->ip)
+		arp_unlink(e);
+	list_move_tail(&e->lru, &arp_entries.lru);
+	return e;
+}
+
+static arp_entry_t *__arp_add_entry(uint32_t ip)
+{
+	arp_entry_t *e = arp_lookup(ip);
+	uint16_t *bucket;
+
+	if (e) {
+		list_move_tail(&e->lru, &arp_entries.lru);
+		return e;
+	}
+	e = arp_alloc_entry();
+	e->ip = ip;
+	bucket = &arp_entries.buckets[arp_hash(ip)];
+	e->next = *bucket;
+	*bucket = e - arp_entries.entries + 1;
+	return e;
+}
+#else
+static arp_entry_t *arp_lookup(uint32_t ip)
 {
 	int i;
 
+	/* 0 marks free entries */
+	if (ip == 0)
+		return NULL;
 	/* linear search ... that's bad but it saves space */
 	for (i = 0; i < CONFIG_ARP_TABLE_SIZE; i++) {
-		if (arp_entries.entries[i].ip == *ip) {
-			*mac = arp_entries.entries[i].mac;
-#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-			*iface = arp_entries.entries[i].iface;
-#else
-			(void)iface;
-#endif
-			return 0;
-		}
+		if (arp_entries.entries[i].ip == ip)
+			return &arp_entries.entries[i];
 	}
-	return -1;
+	return NULL;
 }
 
-void arp_add_entry(const uint8_t *sha, const uint8_t *spa, const iface_t *iface)
+#ifdef CONFIG_ARP_EXPIRY
+static void arp_del_entry(arp_entry_t *e)
 {
-	int i;
-	arp_entry_t *e = &arp_entries.entries[arp_entries.pos];
-	uint8_t *ip = (uint8_t *)&e->ip;
+	e->ip = 0;
+}
+#endif
+
+int
+arp_find_entry(const uint32_t *ip, const uint8_t **mac, iface_t **iface)
+{
+	arp_entry_t *e = arp_lookup(*ip);
+
+	if (e == NULL)
+		return -1;
+	arp_entry_get(e, mac, iface);
+	return 0;
+}
+
+static arp_entry_t *__arp_add_entry(uint32_t ip)
+{
+	arp_entry_t *e = arp_lookup(ip);
 
 	STATIC_ASSERT(POWEROF2(CONFIG_ARP_TABLE_SIZE));
 
-	for (i = 0; i < IP_ADDR_LEN; i++)
-		ip[i] = spa[i];
+	if (e)
+		return e;
+	e = &arp_entries.entries[arp_entries.pos];
+	e->ip = ip;
+	arp_entries.pos = (arp_entries.pos + 1) & (CONFIG_ARP_TABLE_SIZE - 1);
+	return e;
+}
+#endif
 
-	for (i = 0; i < ETHER_ADDR_LEN; i++)
-		e->mac[i] = sha[i];
+#ifdef CONFIG_ARP_EXPIRY
+static tim_t arp_timer;
 
+static inline iface_t *arp_entry_iface(const arp_entry_t *e)
+{
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
-	e->iface = iface;
+	return e->iface;
 #else
-	(void)iface;
+	return dft_route.iface;
+#endif
+}
+
+/* Age the entries every second. Instead of being dropped, entries used
+ * since their last update are confirmed with unicast requests, they
+ * expire if the host does not answer.
+ */
+static void arp_expiry_cb(void *arg)
+{
+	int i;
+
+	STATIC_ASSERT(CONFIG_ARP_EXPIRY + ARP_PROBES <= 255);
+	for (i = 0; i < CONFIG_ARP_TABLE_SIZE; i++) {
+		arp_entry_t *e = &arp_entries.entries[i];
+		iface_t *iface;
+
+		if (e->ip == 0 || ++e->age < CONFIG_ARP_EXPIRY)
+			continue;
+		if (e->used && e->age < CONFIG_ARP_EXPIRY + ARP_PROBES
+		    && (iface = arp_entry_iface(e))) {
+			arp_output(iface, ARPOP_REQUEST, e->mac,
+				   (uint8_t *)&e->ip);
+			continue;
+		}
+		arp_del_entry(e);
+	}
+	if (arg)
+		timer_reschedule(&arp_timer, 1000000);
+}
+#endif
+
+void arp_add_entry(const uint8_t *sha, const uint8_t *spa, const iface_t *iface)
+{
+	uint32_t ip;
+
+	memcpy(&ip, spa, IP_ADDR_LEN);
+	/* ARP probes */
+	if (ip == 0)
+		return;
+	arp_entry_set(__arp_add_entry(ip), sha, iface);
+#ifdef CONFIG_ARP_EXPIRY
+	if (arp_timer.list.next == NULL)
+		timer_init(&arp_timer);
+	if (!timer_is_pending(&arp_timer))
+		timer_add(&arp_timer, 1000000, arp_expiry_cb, &arp_timer);
 #endif
-	arp_entries.pos = (arp_entries.pos + 1) & (CONFIG_ARP_TABLE_SIZE - 1);
 }
 
 #ifdef CONFIG_IPV6
@@ -119,7 +311,7 @@ arp_output(iface_t *iface, int op, const uint8_t *tha, const uint8_t *tpa)
 	uint8_t *data;
 	uint8_t arp_hdr_len;
 
-	if ((out = pkt_alloc()) == NULL
+	if ((out = pkt_alloc_size(ARP_PKT_SIZE)) == NULL
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	    && (out = pkt_alloc_emergency()) == NULL
 #endif
@@ -155,54 +347,49 @@ arp_output(iface_t *iface, int op, const uint8_t *tha, const uint8_t *tpa)
 	return eth_output(out, iface, L3_PROTO_ARP, tha);
 }
 
-static uint32_t *arp_res_get_ip(arp_res_t *arp_res)
-{
-	pkt_t *pkt = list_first_entry(&arp_res->pkt_list, pkt_t, list);
-	ip_hdr_t *ip_hdr = btod(pkt);
-
-	return &ip_hdr->dst;
-}
-
-static arp_res_t *arp_res_lookup(const uint32_t *ip)
+static arp_res_t *arp_res_lookup(const iface_t *iface, uint32_t ip)
 {
-	arp_res_t *arp_res;
+	int i;
 
-	list_for_each_entry(arp_res, &arp_wait_list, list) {
-		uint32_t *arp_res_ip = arp_res_get_ip(arp_res);
+	for (i = 0; i < CONFIG_ARP_RES_SLOTS; i++) {
+		arp_res_t *arp_res = &arp_res_slots[i];
 
-		if (*arp_res_ip == *ip)
+		if (arp_res->iface == iface && (iface == NULL
+						|| arp_res->ip == ip))
 			return arp_res;
 	}
 	return NULL;
 }
 
-static void __arp_process_wait_list(arp_res_t *arp_res, uint8_t delete)
+/* hand the queued packets to the driver or drop them if mac is NULL */
+static void __arp_process_wait_list(arp_res_t *arp_res, const uint8_t *mac)
 {
 	pkt_t *pkt, *pkt_tmp;
 
+	timer_del(&arp_res->tim);
+	if (mac == NULL)
+		arp_drop_stats.unresolved += arp_res->nb_pkts;
 	list_for_each_entry_safe(pkt, pkt_tmp, &arp_res->pkt_list, list) {
 		list_del(&pkt->list);
-		if (delete)
+		if (mac == NULL)
 			pkt_free(pkt);
-		else {
-			ip_hdr_t *ip_hdr = btod(pkt);
-
-			eth_output(pkt, arp_res->iface, ETHERTYPE_IP,
-				   &ip_hdr->dst);
-		}
+		else
+			__eth_output(pkt, arp_res->iface, ETHERTYPE_IP, mac);
 	}
-	timer_del(&arp_res->tim);
-	list_del(&arp_res->list);
-	free(arp_res);
+	arp_res->iface = NULL;
+	arp_res->nb_pkts = 0;
 }
 
-static void arp_process_wait_list(uint32_t *ip, uint8_t delete)
+static void arp_process_wait_list(const uint8_t *spa, const uint8_t *sha,
+				  const iface_t *iface)
 {
 	arp_res_t *arp_res;
+	uint32_t ip;
 
-	if ((arp_res = arp_res_lookup(ip)) == NULL)
+	memcpy(&ip, spa, IP_ADDR_LEN);
+	if ((arp_res = arp_res_lookup(iface, ip)) == NULL)
 		return;
-	__arp_process_wait_list(arp_res, delete);
+	__arp_process_wait_list(arp_res, sha);
 }
 
 void arp_input(pkt_t *pkt, iface_t *iface)
@@ -260,7 +447,7 @@ void arp_input(pkt_t *pkt, iface_t *iface)
 		}
 #endif
 		arp_add_entry(sha, spa, iface);
-		arp_process_wait_list((uint32_t *)spa, 0);
+		arp_process_wait_list(spa, sha, iface);
 		break;
 
 	default:
@@ -275,26 +462,28 @@ void arp_input(pkt_t *pkt, iface_t *iface)
 void arp_retry_cb(void *arg)
 {
 	arp_res_t *arp_res = arg;
-	uint32_t *ip;
 
 	arp_res->retries++;
 	if (arp_res->retries >= ARP_RETRIES) {
-		__arp_process_wait_list(arp_res, 1);
+		__arp_process_wait_list(arp_res, NULL);
 		return;
 	}
 	timer_reschedule(&arp_res->tim, ARP_RETRY_TIMEOUT * 1000000);
-	ip = arp_res_get_ip(arp_res);
-	arp_output(arp_res->iface, ARPOP_REQUEST, broadcast_mac, (uint8_t *)ip);
+	arp_output(arp_res->iface, ARPOP_REQUEST, broadcast_mac,
+		   (uint8_t *)&arp_res->ip);
 }
 
 void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface)
 {
-	arp_res_t *arp_res;
+	arp_res_t *arp_res = arp_res_lookup(iface, *ip_dst);
 #ifdef CONFIG_TCP_RETRANSMIT
 	ip_hdr_t *ip_hdr = btod(pkt);
 #endif
 
-	arp_output(iface, ARPOP_REQUEST, broadcast_mac, (uint8_t *)ip_dst);
+	/* pending resolutions are retried by their timer */
+	if (arp_res == NULL)
+		arp_output(iface, ARPOP_REQUEST, broadcast_mac,
+			   (uint8_t *)ip_dst);
 
 #ifdef CONFIG_TCP_RETRANSMIT
 	if (ip_hdr->p == IPPROTO_TCP) {
@@ -302,38 +491,62 @@ void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface)
 		return;
 	}
 #endif
-	if ((arp_res = arp_res_lookup(ip_dst))) {
+	if (arp_res) {
+		if (arp_res->nb_pkts >= CONFIG_ARP_RES_QUEUE_MAX) {
+			arp_drop_stats.queue_full++;
+			pkt_free(pkt);
+			return;
+		}
 		list_add_tail(&pkt->list, &arp_res->pkt_list);
+		arp_res->nb_pkts++;
 		return;
 	}
 
-	if ((arp_res = malloc(sizeof(arp_res_t))) == NULL) {
+	if ((arp_res = arp_res_lookup(NULL, 0)) == NULL) {
+		arp_drop_stats.no_slot++;
 		pkt_free(pkt);
 		return;
 	}
-	memset(&arp_res->tim, 0, sizeof(tim_t));
-	INIT_LIST_HEAD(&arp_res->list);
 	INIT_LIST_HEAD(&arp_res->pkt_list);
 	timer_init(&arp_res->tim);
 	list_add_tail(&pkt->list, &arp_res->pkt_list);
+	arp_res->ip = *ip_dst;
+	arp_res->nb_pkts = 1;
 	arp_res->retries = 0;
 	arp_res->iface = iface;
 	timer_add(&arp_res->tim, ARP_RETRY_TIMEOUT * 1000000, arp_retry_cb,
 		  arp_res);
-	/* add a hash table on ip_dst if we have more RAM */
-	list_add_tail(&arp_res->list, &arp_wait_list);
 }
 
+void arp_shutdown(void)
+{
+	int i;
+
+	for (i = 0; i < CONFIG_ARP_RES_SLOTS; i++)
+		if (arp_res_slots[i].iface)
+			__arp_process_wait_list(&arp_res_slots[i], NULL);
 #ifdef CONFIG_ARP_EXPIRY
-static void arp_flush(void)
+	/* lazily initialized */
+	if (arp_timer.list.next)
+		timer_del(&arp_timer);
+#endif
+}
+
+void arp_stats(arp_stats_t *stats)
 {
-	/* TODO */
+	*stats = arp_drop_stats;
 }
-#endif
 
 #ifdef TEST
 arp_entries_t *arp_get_entries(void)
 {
 	return &arp_entries;
 }
+
+#ifdef CONFIG_ARP_EXPIRY
+void arp_age_entries(void)
+{
+	arp_expiry_cb(NULL);
+}
+#endif
 #endif
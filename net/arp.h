@@ -43,13 +43,18 @@ struct arp_hdr {
 typedef struct arp_hdr arp_hdr_t;
 
 typedef struct arp_entry {
-	uint32_t ip;
+	uint32_t ip; /* 0 if unused */
 	uint8_t mac[ETHER_ADDR_LEN];
 #ifdef CONFIG_MORE_THAN_ONE_INTERFACE
 	iface_t *iface;
 #endif
 #ifdef CONFIG_ARP_EXPIRY
-	uint8_t updated; /* used by arp_timer */
+	uint8_t age; /* seconds since the last ARP update */
+	uint8_t used; /* looked up since the last ARP update */
+#endif
+#ifdef CONFIG_ARP_HASH
+	list_t lru;
+	uint16_t next; /* hash chain, entry index + 1 */
 #endif
 } arp_entry_t;
 
@@ -57,10 +62,24 @@ typedef struct arp_entry {
 #define CONFIG_ARP_TABLE_SIZE 2
 #endif
 
+#ifdef CONFIG_ARP_HASH
+#define ARP_HASH_SIZE (CONFIG_ARP_TABLE_SIZE * 2)
+
+/* Hashed cache: buckets hold chains of entry indexes + 1, 0 ends a
+ * chain. Entries are evicted in least recently used order.
+ */
+typedef struct arp_entries {
+	arp_entry_t entries[CONFIG_ARP_TABLE_SIZE];
+	uint16_t buckets[ARP_HASH_SIZE];
+	list_t lru; /* least recently used first, lazily initialized */
+	uint16_t nb;
+} arp_entries_t;
+#else
 typedef struct arp_entries {
 	arp_entry_t entries[CONFIG_ARP_TABLE_SIZE];
 	uint8_t pos;
 } arp_entries_t;
+#endif
 
 #ifdef CONFIG_IPV6
 typedef struct arp6_entry {
@@ -77,6 +96,32 @@ typedef struct arp6_entries {
 } arp6_entries_t;
 #endif
 
+/* number of destinations being resolved at once */
+#ifndef CONFIG_ARP_RES_SLOTS
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_ARP_RES_SLOTS 2
+#else
+#define CONFIG_ARP_RES_SLOTS 8
+#endif
+#endif
+
+/* packets queued per destination being resolved */
+#ifndef CONFIG_ARP_RES_QUEUE_MAX
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_ARP_RES_QUEUE_MAX 2
+#else
+#define CONFIG_ARP_RES_QUEUE_MAX 4
+#endif
+#endif
+
+/** Packets dropped waiting for address resolution
+ */
+typedef struct arp_stats {
+	uint16_t queue_full; /* destination queue full */
+	uint16_t no_slot;    /* no free resolution slot */
+	uint16_t unresolved; /* destination did not answer */
+} arp_stats_t;
+
 extern uint8_t broadcast_mac[];
 
 /** Arp input
@@ -94,10 +139,33 @@ arp_add_entry(const uint8_t *sha, const uint8_t *spa, const iface_t *iface);
 static void arp6_add_entry(uint8_t *sha, uint8_t *spa, const iface_t *iface);
 #endif
 
+/** Queue a packet until its destination is resolved
+ *
+ * At most CONFIG_ARP_RES_SLOTS destinations are resolved at once, each
+ * with up to CONFIG_ARP_RES_QUEUE_MAX queued packets. Other packets
+ * are dropped.
+ * @param[in] pkt     IP packet
+ * @param[in] ip_dst  destination address
+ * @param[in] iface   interface
+ */
 void arp_resolve(pkt_t *pkt, const uint32_t *ip_dst, iface_t *iface);
 
+/** Drop the packets waiting for address resolution
+ */
+void arp_shutdown(void);
+
+/** Get ARP drop statistics
+ *
+ * @param[out] stats  statistics
+ */
+void arp_stats(arp_stats_t *stats);
+
 #ifdef TEST
 arp_entries_t *arp_get_entries(void);
+#ifdef CONFIG_ARP_EXPIRY
+/* run the one second expiry timer callback */
+void arp_age_entries(void);
+#endif
 #endif
 
 #endif
@@ -25,6 +25,22 @@ ifdef CONFIG_TIMER_CHECKS
 CFLAGS += -DCONFIG_TIMER_CHECKS
 endif
 
+ifdef CONFIG_TIMER_TICKLESS
+CFLAGS += -DCONFIG_TIMER_TICKLESS
+endif
+
+ifdef CONFIG_TIMER_WHEEL_BITS
+CFLAGS += -DCONFIG_TIMER_WHEEL_BITS=$(CONFIG_TIMER_WHEEL_BITS)
+endif
+
+ifdef CONFIG_TIMER_WHEEL_LEVELS
+CFLAGS += -DCONFIG_TIMER_WHEEL_LEVELS=$(CONFIG_TIMER_WHEEL_LEVELS)
+endif
+
+ifdef CONFIG_SCHEDULER_CPUS
+CFLAGS += -DCONFIG_SCHEDULER_CPUS=$(CONFIG_SCHEDULER_CPUS)
+endif
+
 SRC = ../sys/timer.c ../arch/$(ARCH)/timer.c ../sys/scheduler.c ../crypto/xtea.c
 
 ifdef CONFIG_ETHERNET
@@ -41,14 +57,56 @@ CFLAGS += -DCONFIG_IP
 ifdef CONFIG_IP_TTL
 CFLAGS += -DCONFIG_IP_TTL=$(CONFIG_IP_TTL)
 endif
+ifdef CONFIG_IP_PROTO_NB
+CFLAGS += -DCONFIG_IP_PROTO_NB=$(CONFIG_IP_PROTO_NB)
+endif
+ifdef CONFIG_IP_FRAG
+SRC += ip-frag.c
+CFLAGS += -DCONFIG_IP_FRAG
+ifdef CONFIG_IP_MTU
+CFLAGS += -DCONFIG_IP_MTU=$(CONFIG_IP_MTU)
+endif
+ifdef CONFIG_IP_REASS_NB
+CFLAGS += -DCONFIG_IP_REASS_NB=$(CONFIG_IP_REASS_NB)
+endif
+ifdef CONFIG_IP_REASS_TIMEOUT
+CFLAGS += -DCONFIG_IP_REASS_TIMEOUT=$(CONFIG_IP_REASS_TIMEOUT)
+endif
+endif
+ifdef CONFIG_IP_FORWARD
+ifeq ($(CONFIG_MORE_THAN_ONE_INTERFACE),)
+$(error CONFIG_MORE_THAN_ONE_INTERFACE is required for IP forwarding)
+endif
+CFLAGS += -DCONFIG_IP_FORWARD
+endif
 endif
 
 SRC += tr-chksum.c ../sys/chksum.c route.c
+ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+CFLAGS += -DCONFIG_MORE_THAN_ONE_INTERFACE
+ifdef CONFIG_IP_ROUTE_NB
+CFLAGS += -DCONFIG_IP_ROUTE_NB=$(CONFIG_IP_ROUTE_NB)
+endif
+ifdef CONFIG_IP_ROUTE_CACHE_SIZE
+CFLAGS += -DCONFIG_IP_ROUTE_CACHE_SIZE=$(CONFIG_IP_ROUTE_CACHE_SIZE)
+endif
+endif
 
 ifdef CONFIG_PKT_NB_MAX
 CFLAGS += -DCONFIG_PKT_NB_MAX=$(CONFIG_PKT_NB_MAX)
 CFLAGS += -DCONFIG_PKT_SIZE=$(CONFIG_PKT_SIZE)
 CFLAGS += -DCONFIG_PKT_DRIVER_NB_MAX=$(CONFIG_PKT_DRIVER_NB_MAX)
+ifdef CONFIG_PKT_IDX_WIDTH
+CFLAGS += -DCONFIG_PKT_IDX_WIDTH=$(CONFIG_PKT_IDX_WIDTH)
+endif
+ifdef CONFIG_PKT_SMALL_NB_MAX
+CFLAGS += -DCONFIG_PKT_SMALL_NB_MAX=$(CONFIG_PKT_SMALL_NB_MAX)
+CFLAGS += -DCONFIG_PKT_SMALL_SIZE=$(CONFIG_PKT_SMALL_SIZE)
+endif
+ifdef CONFIG_PKT_MEDIUM_NB_MAX
+CFLAGS += -DCONFIG_PKT_MEDIUM_NB_MAX=$(CONFIG_PKT_MEDIUM_NB_MAX)
+CFLAGS += -DCONFIG_PKT_MEDIUM_SIZE=$(CONFIG_PKT_MEDIUM_SIZE)
+endif
 SRC += pkt-mempool.c
 ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 CFLAGS += -DCONFIG_PKT_MEM_POOL_EMERGENCY_PKT=$(CONFIG_PKT_MEM_POOL_EMERGENCY_PKT)
@@ -83,6 +141,15 @@ ifdef CONFIG_TCP_CLIENT
 CFLAGS += -DCONFIG_TCP_CLIENT
 endif
 CFLAGS += -DCONFIG_TCP_MAX_CONNS=$(CONFIG_TCP_MAX_CONNS)
+ifdef CONFIG_TCP_CONN_TABLE_SIZE
+CFLAGS += -DCONFIG_TCP_CONN_TABLE_SIZE=$(CONFIG_TCP_CONN_TABLE_SIZE)
+endif
+ifdef CONFIG_TCP_OOO_MAX_PKTS
+CFLAGS += -DCONFIG_TCP_OOO_MAX_PKTS=$(CONFIG_TCP_OOO_MAX_PKTS)
+endif
+ifdef CONFIG_TCP_SND_QUEUE_MAX
+CFLAGS += -DCONFIG_TCP_SND_QUEUE_MAX=$(CONFIG_TCP_SND_QUEUE_MAX)
+endif
 endif
 ifdef CONFIG_TCP_RETRANSMIT
 CFLAGS += -DCONFIG_TCP_RETRANSMIT
@@ -98,7 +165,19 @@ CFLAGS += -DCONFIG_ARP_TABLE_SIZE=$(CONFIG_ARP_TABLE_SIZE)
 endif
 
 ifdef CONFIG_ARP_EXPIRY
-CFLAGS += -DCONFIG_ARP_EXPIRY
+CFLAGS += -DCONFIG_ARP_EXPIRY=$(CONFIG_ARP_EXPIRY)
+endif
+
+ifdef CONFIG_ARP_HASH
+CFLAGS += -DCONFIG_ARP_HASH
+endif
+
+ifdef CONFIG_ARP_RES_SLOTS
+CFLAGS += -DCONFIG_ARP_RES_SLOTS=$(CONFIG_ARP_RES_SLOTS)
+endif
+
+ifdef CONFIG_ARP_RES_QUEUE_MAX
+CFLAGS += -DCONFIG_ARP_RES_QUEUE_MAX=$(CONFIG_ARP_RES_QUEUE_MAX)
 endif
 
 ifeq "$(or $(CONFIG_UDP), $(CONFIG_TCP))" "y"
@@ -115,8 +194,22 @@ ifeq ($(CONFIG_MAX_SOCK_HT_SIZE),)
 $(error CONFIG_MAX_SOCK_HT_SIZE not set)
 endif
 CFLAGS += -DCONFIG_MAX_SOCK_HT_SIZE=$(CONFIG_MAX_SOCK_HT_SIZE)
+ifdef CONFIG_HT_OPEN_ADDRESSING
+SRC += ../sys/hash-tables-oa.c
+else
 SRC += ../sys/hash-tables.c
 endif
+endif
+
+ifdef CONFIG_HT_OPEN_ADDRESSING
+CFLAGS += -DCONFIG_HT_OPEN_ADDRESSING
+ifdef CONFIG_HT_KEY_SIZE
+CFLAGS += -DCONFIG_HT_KEY_SIZE=$(CONFIG_HT_KEY_SIZE)
+endif
+ifdef CONFIG_HT_VAL_SIZE
+CFLAGS += -DCONFIG_HT_VAL_SIZE=$(CONFIG_HT_VAL_SIZE)
+endif
+endif
 
 ifdef CONFIG_BSD_COMPAT
 CFLAGS += -DCONFIG_BSD_COMPAT
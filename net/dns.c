@@ -205,7 +205,7 @@ static void ev_dns_cb(event_t *ev, uint8_t events)
 	ctx->cb(ip);
 	dns_query_ctx_free(ctx);
  error:
-	pkt_free(pkt);
+	pkt_chain_free(pkt);
 }
 
 static int dns_query_ctx_init(dns_query_ctx_t *ctx, const sbuf_t *sb)
@@ -70,11 +70,26 @@ void eth_input(iface_t *iface)
 		__eth_input(pkt, iface);
 }
 
-int
-eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
+/* send a packet whose destination is resolved */
+int __eth_output(pkt_t *out, iface_t *iface, uint16_t l3_proto,
+		 const uint8_t *mac_dst)
 {
 	eth_hdr_t *eh;
 	int i;
+
+	pkt_adj(out, -(int)sizeof(eth_hdr_t));
+	eh = btod(out);
+	for (i = 0; i < ETHER_ADDR_LEN; i++) {
+		eh->dst[i] = mac_dst[i];
+		eh->src[i] = iface->hw_addr[i];
+	}
+	eh->type = l3_proto;
+	return iface->send(iface, out);
+}
+
+int
+eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
+{
 	const uint8_t *mac_dst;
 	uint16_t l3_proto;
 
@@ -97,15 +112,7 @@ eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst)
 		/* unsupported */
 		goto end;
 	}
-
-	pkt_adj(out, -(int)sizeof(eth_hdr_t));
-	eh = btod(out);
-	for (i = 0; i < ETHER_ADDR_LEN; i++) {
-		eh->dst[i] = mac_dst[i];
-		eh->src[i] = iface->hw_addr[i];
-	}
-	eh->type = l3_proto;
-	return iface->send(iface, out);
+	return __eth_output(out, iface, l3_proto, mac_dst);
  end:
 	pkt_free(out);
 	/* TODO update iface stats */
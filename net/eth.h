@@ -38,5 +38,7 @@ typedef struct eth_hdr eth_hdr_t;
 struct iface;
 void eth_input(iface_t *iface);
 int eth_output(pkt_t *out, iface_t *iface, uint8_t type, const void *dst);
+int __eth_output(pkt_t *out, iface_t *iface, uint16_t l3_proto,
+		 const uint8_t *mac_dst);
 
 #endif
@@ -31,6 +31,8 @@ static void event_cb(void *arg)
 {
 	event_t *ev = arg;
 
+	/* events set from now on need a new pass */
+	ev->scheduled = 0;
 	while (ev->available && (ev->available & ev->wanted)) {
 		uint8_t events;
 
@@ -66,16 +68,22 @@ void event_schedule_event(event_t *ev, uint8_t events)
 			__list_del_entry(&ev->list);
 	}
 
-	if (ev->wanted & events)
-		schedule_task(event_cb, ev);
+	/* one queued task drains all the available events */
+	if ((ev->wanted & events) && !ev->scheduled) {
+		ev->scheduled = 1;
+		ev->task.cb = event_cb;
+		ev->task.arg = ev;
+		schedule_embedded_task(&ev->task, SCHEDULER_PRIO_NORMAL);
+	}
 }
 
 void event_unregister(event_t *ev)
 {
-	ev->available = ev->wanted = 0;
+	ev->available = ev->wanted = ev->scheduled = 0;
 
 	if (!list_empty(&ev->list))
 		__list_del_entry(&ev->list);
+	scheduler_cancel_task(&ev->task);
 }
 
 void event_resume_write_events(void)
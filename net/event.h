@@ -47,8 +47,10 @@ typedef struct event {
 	void (*cb)(struct event *event_data, uint8_t events);
 	uint8_t wanted;
 	uint8_t available;
+	uint8_t scheduled; /* event_cb() task queued */
 	list_t list;
 	list_t *rx_queue;
+	sched_task_t task;
 } event_t;
 
 void event_schedule_event(event_t *ev, uint8_t events);
@@ -60,8 +62,9 @@ void event_resume_write_events(void);
 
 static inline void event_init(event_t *ev)
 {
-	ev->wanted = ev->available = 0;
+	ev->wanted = ev->available = ev->scheduled = 0;
 	INIT_LIST_HEAD(&ev->list);
+	INIT_LIST_HEAD(&ev->task.list);
 }
 
 static inline void event_set_mask(event_t *ev, uint8_t events)
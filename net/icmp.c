@@ -52,16 +52,23 @@ icmp_output(pkt_t *out, iface_t *iface, int type, int code, uint16_t id,
 	return ip_output(out, iface, ip_flags);
 }
 
-void icmp_input(pkt_t *pkt, iface_t *iface)
+void icmp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info)
 {
 	icmp_hdr_t *icmp_hdr;
-	ip_hdr_t *ip = btod(pkt);
+	ip_hdr_t *ip = info->hdr;
 	ip_hdr_t *ip2;
 	buf_t id_data;
 	pkt_t *out;
 
+#ifdef CONFIG_IP_FRAG
+	/* replies are built in a single packet */
+	if (pkt->next && pkt_chain_linearize(pkt) < 0) {
+		pkt_chain_free(pkt);
+		return;
+	}
+#endif
 	/* XXX make sure pkt_adj is the same in all *_output() functions */
-	pkt_adj(pkt, ip->hl * 4);
+	pkt_adj(pkt, info->hdr_len);
 
 	icmp_hdr = btod(pkt);
 	pkt_adj(pkt, sizeof(icmp_hdr_t));
@@ -69,7 +76,9 @@ void icmp_input(pkt_t *pkt, iface_t *iface)
 
 	switch (icmp_hdr->type) {
 	case ICMP_ECHO:
-		if ((out = pkt_alloc()) == NULL) {
+		if ((out = pkt_alloc_size(sizeof(eth_hdr_t) + sizeof(ip_hdr_t)
+					  + sizeof(icmp_hdr_t)
+					  + pkt_len(pkt))) == NULL) {
 			/* inc stats */
 			pkt_free(pkt);
 			return;
@@ -26,6 +26,7 @@
 #define _ICMP_H_
 
 #include "config.h"
+#include "ip.h"
 
 struct icmp {
 	uint8_t   type;  /* type of message */
@@ -41,7 +42,7 @@ typedef struct icmp icmp_hdr_t;
 #define MAX_ICMP_DATA_SIZE (int)(CONFIG_PKT_SIZE - sizeof(eth_hdr_t) \
 				 - sizeof(ip_hdr_t) - sizeof(icmp_hdr_t))
 
-void icmp_input(pkt_t *pkt, iface_t *iface);
+void icmp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info);
 int
 icmp_output(pkt_t *out, iface_t *iface, int type, int code,
 	    uint16_t id, uint16_t seq, const buf_t *id_data, uint16_t ip_flags);
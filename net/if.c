@@ -36,10 +36,12 @@ static void if_refill_driver_pkt_pool(const iface_t *iface)
 {
 	pkt_t *pkt;
 
-	while (!ring_is_full(iface->pkt_pool) && (pkt = pkt_alloc()))
+	while (!pkt_ring_is_full(iface->pkt_pool) && (pkt = pkt_alloc()))
 		pkt_put(iface->pkt_pool, pkt);
 }
 
+static void if_schedule_receive_cb(void *arg);
+
 void if_init(iface_t *ifce, uint8_t type, ring_t *pkt_pool, ring_t *rx,
 	     ring_t *tx, uint8_t is_interrupt_driven)
 {
@@ -69,6 +71,7 @@ void if_init(iface_t *ifce, uint8_t type, ring_t *pkt_pool, ring_t *rx,
 	}
 	ifce->rx = rx;
 	ifce->tx = tx;
+	sched_task_init(&ifce->rx_task, if_schedule_receive_cb, ifce);
 
 	if (is_interrupt_driven) {
 		ifce->pkt_pool = pkt_pool;
@@ -87,7 +90,7 @@ static void if_schedule_receive_cb(void *arg)
 void if_schedule_receive(iface_t *iface, pkt_t **pkt)
 {
 	if (ring_is_empty(iface->rx) || ring_is_empty(iface->pkt_pool))
-		schedule_task(if_schedule_receive_cb, iface);
+		schedule_embedded_task(&iface->rx_task, SCHEDULER_PRIO_LOW);
 	if (pkt && *pkt) {
 		pkt_put(iface->rx, *pkt);
 		*pkt = NULL;
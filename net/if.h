@@ -26,6 +26,7 @@
 #define _IF_H_
 #include <sys/buf.h>
 #include <sys/list.h>
+#include <sys/scheduler.h>
 
 #include "config.h"
 
@@ -84,6 +85,7 @@ struct iface {
 	ring_t *tx;
 	/* interrupt handler's pkt ring */
 	ring_t *pkt_pool;
+	sched_task_t rx_task;
 } __PACKED__;
 typedef struct iface iface_t;
 
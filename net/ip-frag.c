@@ -0,0 +1,290 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+#include <sys/utils.h>
+#include <sys/timer.h>
+#include "ip.h"
+#include "eth.h"
+
+/* fragments kept per datagram */
+#ifdef CONFIG_AVR_MCU
+#define IP_REASS_FRAG_MAX 4
+#else
+#define IP_REASS_FRAG_MAX 16
+#endif
+
+#define IP_FRAG_MF_OFF (IP_MF | htons(IP_OFFMASK))
+
+typedef struct ip_reass_ctx {
+	tim_t tim;
+	pkt_t *frags; /* sorted by offset, NULL if the context is free */
+	uint32_t src;
+	uint32_t dst;
+	uint16_t id;
+	uint16_t len; /* payload length, 0 until the last fragment is in */
+	uint8_t p;
+	uint8_t nb_frags;
+} ip_reass_ctx_t;
+
+static ip_reass_ctx_t ip_reass_ctxs[CONFIG_IP_REASS_NB];
+
+static inline uint16_t ip_frag_off(const ip_hdr_t *ip)
+{
+	return (ntohs(ip->off) & IP_OFFMASK) * 8;
+}
+
+static inline uint16_t ip_frag_plen(const ip_hdr_t *ip)
+{
+	return ntohs(ip->len) - ip->hl * 4;
+}
+
+static void ip_reass_release(ip_reass_ctx_t *ctx)
+{
+	timer_del(&ctx->tim);
+	pkt_chain_free(ctx->frags);
+	ctx->frags = NULL;
+}
+
+static void ip_reass_timeout_cb(void *arg)
+{
+	ip_reass_ctx_t *ctx = arg;
+
+	/* inc stats */
+	pkt_chain_free(ctx->frags);
+	ctx->frags = NULL;
+}
+
+static ip_reass_ctx_t *ip_reass_lookup(const ip_hdr_t *ip)
+{
+	ip_reass_ctx_t *ctx, *free_ctx = NULL;
+
+	for (ctx = ip_reass_ctxs; ctx < ip_reass_ctxs + CONFIG_IP_REASS_NB;
+	     ctx++) {
+		if (ctx->frags == NULL) {
+			if (free_ctx == NULL)
+				free_ctx = ctx;
+			continue;
+		}
+		if (ctx->id == ip->id && ctx->src == ip->src
+		    && ctx->dst == ip->dst && ctx->p == ip->p)
+			return ctx;
+	}
+	if ((ctx = free_ctx) == NULL)
+		return NULL;
+
+	ctx->src = ip->src;
+	ctx->dst = ip->dst;
+	ctx->id = ip->id;
+	ctx->p = ip->p;
+	ctx->len = 0;
+	ctx->nb_frags = 0;
+	timer_init(&ctx->tim);
+	timer_add(&ctx->tim, CONFIG_IP_REASS_TIMEOUT * 1000000,
+		  ip_reass_timeout_cb, ctx);
+	return ctx;
+}
+
+/* insert a fragment by offset, overlapping fragments are refused */
+static int ip_reass_insert(ip_reass_ctx_t *ctx, pkt_t *pkt, uint16_t off,
+			   uint16_t plen)
+{
+	pkt_t **frag;
+
+	for (frag = &ctx->frags; *frag; frag = &(*frag)->next) {
+		const ip_hdr_t *ip = btod(*frag);
+		uint16_t frag_off = ip_frag_off(ip);
+
+		if (off + plen <= frag_off)
+			break;
+		if (off < frag_off + ip_frag_plen(ip))
+			return -1;
+	}
+	pkt->next = *frag;
+	*frag = pkt;
+	ctx->nb_frags++;
+	return 0;
+}
+
+static int ip_reass_is_complete(const ip_reass_ctx_t *ctx)
+{
+	const pkt_t *frag;
+	uint16_t off = 0;
+
+	if (ctx->len == 0)
+		return 0;
+	for (frag = ctx->frags; frag; frag = frag->next) {
+		const ip_hdr_t *ip = btod(frag);
+
+		if (ip_frag_off(ip) != off)
+			return 0;
+		off += ip_frag_plen(ip);
+	}
+	return off == ctx->len;
+}
+
+/* hand the fragments over as a chain, the IP header of the first one
+ * becomes the datagram header and the following ones are trimmed to
+ * their payload */
+static pkt_t *ip_reass_build(ip_reass_ctx_t *ctx, ip_info_t *info)
+{
+	pkt_t *head = ctx->frags, *frag;
+	ip_hdr_t *ip = btod(head);
+	uint16_t hdr_len = ip->hl * 4;
+
+	for (frag = head->next; frag; frag = frag->next) {
+		const ip_hdr_t *frag_ip = btod(frag);
+
+		pkt_adj(frag, frag_ip->hl * 4);
+	}
+	ip->len = htons(hdr_len + ctx->len);
+	ip->off &= ~IP_FRAG_MF_OFF;
+	ip->chksum = 0;
+	ip->chksum = ip_hdr_cksum(ip, hdr_len);
+
+	info->hdr = ip;
+	info->hdr_len = hdr_len;
+	info->plen = ctx->len;
+
+	ctx->frags = NULL;
+	ip_reass_release(ctx);
+	return head;
+}
+
+pkt_t *ip_reass(pkt_t *pkt, ip_info_t *info)
+{
+	const ip_hdr_t *ip = info->hdr;
+	uint16_t off = ip_frag_off(ip);
+	uint16_t plen = info->plen;
+	uint8_t more = (ip->off & IP_MF) != 0;
+	ip_reass_ctx_t *ctx;
+
+	/* all fragments but the last one carry 8 byte blocks */
+	if (plen == 0 || (more && (plen & 7)))
+		goto error;
+	if ((uint32_t)off + plen > 0xFFFF - info->hdr_len)
+		goto error;
+
+	/* remove the link layer padding */
+	pkt->buf.len = info->hdr_len + plen;
+
+	if ((ctx = ip_reass_lookup(ip)) == NULL) {
+		/* no reassembly context left */
+		goto error;
+	}
+	if (ctx->nb_frags >= IP_REASS_FRAG_MAX)
+		goto error;
+	if (ctx->len && (off + plen > ctx->len
+			 || (!more && off + plen != ctx->len)))
+		goto error;
+	/* duplicated or overlapping fragment */
+	if (ip_reass_insert(ctx, pkt, off, plen) < 0)
+		goto error;
+	if (!more)
+		ctx->len = off + plen;
+
+	if (!ip_reass_is_complete(ctx))
+		return NULL;
+	return ip_reass_build(ctx, info);
+
+ error:
+	pkt_free(pkt);
+	/* inc stats */
+	return NULL;
+}
+
+void ip_reass_shutdown(void)
+{
+	int i;
+
+	for (i = 0; i < CONFIG_IP_REASS_NB; i++)
+		if (ip_reass_ctxs[i].frags)
+			ip_reass_release(&ip_reass_ctxs[i]);
+}
+
+/* move the payload beyond len to a new packet inserted after pkt */
+static int ip_frag_split(pkt_t *pkt, int len)
+{
+	int rest = pkt_len(pkt) - len;
+	pkt_t *tail;
+
+	if ((tail = pkt_alloc_size((int)sizeof(eth_hdr_t) + sizeof(ip_hdr_t)
+				   + rest)) == NULL)
+		return -1;
+	pkt_adj(tail, (int)sizeof(eth_hdr_t) + (int)sizeof(ip_hdr_t));
+	__buf_add(&tail->buf, pkt->buf.data + len, rest);
+	pkt->buf.len = len;
+	tail->next = pkt->next;
+	pkt->next = tail;
+	return 0;
+}
+
+int ip_fragment(pkt_t *out, iface_t *iface, const uint32_t *dst)
+{
+	ip_hdr_t hdr = *(ip_hdr_t *)btod(out);
+	int hdr_len = hdr.hl * 4;
+	uint16_t off = ip_frag_off(&hdr);
+	uint16_t more = hdr.off & IP_MF;
+	pkt_t *pkt;
+
+	/* the options are only kept in the first fragment */
+	hdr.hl = sizeof(ip_hdr_t) / 4;
+	hdr.off &= ~IP_FRAG_MF_OFF;
+
+	pkt_adj(out, hdr_len);
+	while ((pkt = out)) {
+		int max_len = (CONFIG_IP_MTU - hdr_len) & ~7;
+		ip_hdr_t *ip;
+		int plen;
+
+		if (pkt_len(pkt) > max_len && ip_frag_split(pkt, max_len) < 0)
+			goto error;
+		out = pkt->next;
+		pkt->next = NULL;
+		plen = pkt_len(pkt);
+		if (out && (plen & 7)) {
+			pkt_free(pkt);
+			goto error;
+		}
+		pkt_adj(pkt, -hdr_len);
+		ip = btod(pkt);
+		if (hdr_len == sizeof(ip_hdr_t))
+			*ip = hdr;
+		ip->len = htons(plen + hdr_len);
+		ip->off = hdr.off | htons(off / 8);
+		if (out || more)
+			ip->off |= IP_MF;
+		ip->chksum = 0;
+		ip->chksum = ip_hdr_cksum(ip, hdr_len);
+		off += plen;
+		hdr_len = sizeof(ip_hdr_t);
+		if (iface->if_output(pkt, iface, L3_PROTO_IP, dst) < 0)
+			goto error;
+	}
+	return 0;
+
+ error:
+	pkt_chain_free(out);
+	/* inc stats */
+	return -1;
+}
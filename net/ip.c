@@ -33,116 +33,360 @@
 #include "udp.h"
 #include "tcp.h"
 
-int ip_output(pkt_t *out, iface_t *iface, uint16_t flags)
+typedef struct ip_proto {
+	uint8_t proto;
+	ip_proto_handler_t handler; /* NULL if the entry is free */
+} ip_proto_t;
+
+/* built-in protocols come first, they are the most looked up */
+static ip_proto_t ip_protos[CONFIG_IP_PROTO_NB] = {
+#ifdef CONFIG_TCP
+	{ .proto = IPPROTO_TCP, .handler = tcp_input },
+#endif
+#ifdef CONFIG_UDP
+	{ .proto = IPPROTO_UDP, .handler = udp_input },
+#endif
+#ifdef CONFIG_ICMP
+	{ .proto = IPPROTO_ICMP, .handler = icmp_input },
+#ifdef CONFIG_IPV6
+	{ .proto = IPPROTO_ICMPV6, .handler = icmp6_input },
+#endif
+#endif
+};
+
+#ifdef CONFIG_IP_FRAG
+static uint16_t ip_next_id;
+#endif
+
+static ip_proto_t *ip_proto_lookup(uint8_t proto)
+{
+	ip_proto_t *ip_proto;
+
+	for (ip_proto = ip_protos; ip_proto < ip_protos + countof(ip_protos);
+	     ip_proto++)
+		if (ip_proto->handler && ip_proto->proto == proto)
+			return ip_proto;
+	return NULL;
+}
+
+static void
+ip_set_transport_cksum(const pkt_t *out, const ip_hdr_t *ip, void *hdr,
+		       uint16_t len, int hdr_len)
+{
+#ifdef CONFIG_IP_FRAG
+	if (out->next) {
+		uint32_t csum;
+
+		/* fragments of a chain have even lengths */
+		csum = cksum_partial((uint8_t *)hdr + hdr_len,
+				     pkt_len(out) - hdr_len);
+		csum += pkt_chain_cksum_partial(out->next);
+		__set_transport_cksum(ip, hdr, len, hdr_len, csum);
+		return;
+	}
+#endif
+#ifdef PKT_PAYLOAD_CSUM
+	/* the payload was summed while copied into the packet */
+	if (out->csum) {
+		__set_transport_cksum(ip, hdr, len, hdr_len, out->csum);
+		return;
+	}
+#endif
+	(void)hdr_len;
+	set_transport_cksum(ip, hdr, len);
+}
+
+/* pick the outgoing interface and the next hop of a destination */
+static iface_t *ip_route(uint32_t dst, iface_t *iface, uint32_t *next_hop)
 {
-	ip_hdr_t *ip = btod(out);
-	uint32_t ip_dst;
 	uint32_t *mask;
 	uint32_t *ip_addr;
-	uint16_t payload_len = pkt_len(out);
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+	iface_t *rt_iface;
 
-	if (iface == NULL)
-		iface = dft_route.iface;
+	if ((rt_iface = route_lookup(dst, next_hop)))
+		return rt_iface;
+#endif
+	if (iface == NULL && (iface = dft_route.iface) == NULL)
+		return NULL;
 
-	if (iface == NULL) {
-		/* no interface to send the pkt to */
-		pkt_free(out);
-		return -1;
-	}
 	mask = (uint32_t *)iface->ip4_mask;
 	ip_addr = (uint32_t *)iface->ip4_addr;
+	if ((dst & *mask) != (*ip_addr & *mask))
+		*next_hop = dft_route.ip;
+	else
+		*next_hop = dst;
+	return iface;
+}
+
+int ip_output(pkt_t *out, iface_t *iface, uint16_t flags)
+{
+	ip_hdr_t *ip = btod(out);
+	uint32_t ip_dst;
+	uint16_t payload_len = pkt_chain_len(out);
 
 	/* XXX check for buf_adj coherency with other layers */
 	if (ip->dst == 0) {
 		/* no dest ip address set. Drop the packet */
-		pkt_free(out);
+		pkt_chain_free(out);
 		return -1;
 	}
 
-	ip->src = *ip_addr;
+	if ((iface = ip_route(ip->dst, iface, &ip_dst)) == NULL) {
+		/* no interface to send the pkt to */
+		pkt_chain_free(out);
+		return -1;
+	}
+
+	ip->src = *(uint32_t *)iface->ip4_addr;
 	ip->v = 4;
 	ip->hl = sizeof(ip_hdr_t) / 4;
 	ip->tos = 0;
 	ip->len = htons(payload_len);
+#ifdef CONFIG_IP_FRAG
+	/* fragments are matched on the identification at reassembly */
+	ip->id = (flags & IP_DF) ? 0 : ip_next_id++;
+#else
 	ip->id = 0;
+#endif
 	ip->off = flags;
 	ip->ttl = CONFIG_IP_TTL;
 	assert(ip->p); /* must be set by upper layer */
 	ip->chksum = 0;
-	ip->chksum = cksum(ip, sizeof(ip_hdr_t));
-
-	if ((ip->dst & *mask) != (*ip_addr & *mask))
-		ip_dst = dft_route.ip;
-	else
-		ip_dst = ip->dst;
+	ip->chksum = ip_hdr_cksum(ip, sizeof(ip_hdr_t));
 
 	pkt_adj(out, (int)sizeof(ip_hdr_t));
 	if (ip->p == IPPROTO_UDP) {
 		udp_hdr_t *udp_hdr = btod(out);
-		set_transport_cksum(ip, udp_hdr, udp_hdr->length);
+		ip_set_transport_cksum(out, ip, udp_hdr, udp_hdr->length,
+				       sizeof(udp_hdr_t));
 	} else if (ip->p == IPPROTO_TCP) {
 		tcp_hdr_t *tcp_hdr = btod(out);
-		set_transport_cksum(ip, tcp_hdr,
-				    htons(payload_len - sizeof(ip_hdr_t)));
+		ip_set_transport_cksum(out, ip, tcp_hdr,
+				       htons(payload_len - sizeof(ip_hdr_t)),
+				       tcp_hdr->hdr_len * 4);
 	}
 
 	pkt_adj(out, -(int)sizeof(ip_hdr_t));
+#ifdef CONFIG_IP_FRAG
+	if (payload_len > CONFIG_IP_MTU || out->next) {
+		if (flags & IP_DF) {
+			pkt_chain_free(out);
+			return -1;
+		}
+		return ip_fragment(out, iface, &ip_dst);
+	}
+#endif
 	return iface->if_output(out, iface, L3_PROTO_IP, &ip_dst);
 }
 
-void ip_input(pkt_t *pkt, iface_t *iface)
+#ifdef CONFIG_IP_FORWARD
+#ifndef CONFIG_MORE_THAN_ONE_INTERFACE
+#error "CONFIG_IP_FORWARD requires CONFIG_MORE_THAN_ONE_INTERFACE"
+#endif
+
+#define IP_ADDR_BROADCAST 0xFFFFFFFF
+
+/* limited broadcast, multicast or directed broadcast of the iface */
+static int ip_is_broadcast(uint32_t addr, const iface_t *iface)
 {
-	ip_hdr_t *ip;
-	uint32_t *ip_addr = (uint32_t *)iface->ip4_addr;
-	int ip_len;
+	uint32_t mask = *(uint32_t *)iface->ip4_mask;
 
-	ip = btod(pkt);
+	if (addr == IP_ADDR_BROADCAST
+	    || (addr & htonl(0xF0000000)) == htonl(0xE0000000))
+		return 1;
+	return (addr & mask) == (*(uint32_t *)iface->ip4_addr & mask)
+		&& (addr & ~mask) == ~mask;
+}
 
-	if (ip->v != 4 || ip->dst != *ip_addr || ip->ttl == 0)
-		goto error;
+#ifdef CONFIG_ICMP
+/* no ICMP error about non-first fragments, ICMP errors, or to sources
+ * that do not designate a single host
+ */
+static int ip_forward_may_report(const ip_hdr_t *ip, uint16_t len)
+{
+	uint8_t hdr_len = ip->hl * 4;
 
-	if (ip->off & IP_MF) {
-		/* ip fragmentation is unsupported */
-		goto error;
+	if (ip->off & htons(IP_OFFMASK))
+		return 0;
+	if (ip->src == 0 || ip->src == IP_ADDR_BROADCAST
+	    || (ip->src & htonl(0xF0000000)) == htonl(0xE0000000))
+		return 0;
+	if (ip->p == IPPROTO_ICMP) {
+		const uint8_t *type = (uint8_t *)ip + hdr_len;
+
+		return len > hdr_len
+			&& (*type == ICMP_ECHO || *type == ICMP_ECHOREPLY);
 	}
-	if (ip->hl > IP_MAX_HDR_LEN || ip->hl < IP_MIN_HDR_LEN)
-		goto error;
+	return 1;
+}
 
-	ip_len = ip->hl * 4;
-	if (cksum(ip, ip_len) != 0)
-		goto error;
+/* the error is sent with IP_DF, the quoted datagram is cut to fit */
+#define IP_FWD_ERROR_DATA_MAX MIN(MAX_ICMP_DATA_SIZE,			\
+				  CONFIG_IP_MTU - (int)sizeof(ip_hdr_t)	\
+				  - (int)sizeof(icmp_hdr_t))
 
-#ifdef CONFIG_IP_CHKSUM
-#endif
+/* report a datagram that cannot be forwarded to its source */
+static void
+ip_forward_error(pkt_t *pkt, iface_t *iface, uint16_t len, int type, int code)
+{
+	ip_hdr_t *ip = btod(pkt);
+	ip_hdr_t *ip_out;
+	pkt_t *out;
+	buf_t data;
 
-	switch (ip->p) {
-#ifdef CONFIG_ICMP
-	case IPPROTO_ICMP:
-		icmp_input(pkt, iface);
-		return;
+	if (!ip_forward_may_report(ip, len))
+		goto end;
 
-#ifdef CONFIG_IPV6
-	case IPPROTO_ICMPV6:
-		icmp6_input(pkt, iface);
-		return;
+	buf_init(&data, ip, MIN(IP_FWD_ERROR_DATA_MAX, len));
+	if ((out = pkt_alloc_size(sizeof(eth_hdr_t) + sizeof(ip_hdr_t)
+				  + sizeof(icmp_hdr_t) + data.len)) == NULL)
+		goto end;
+
+	pkt_adj(out, (int)sizeof(eth_hdr_t));
+	ip_out = btod(out);
+	ip_out->dst = ip->src;
+	ip_out->p = IPPROTO_ICMP;
+	pkt_adj(out, (int)sizeof(ip_hdr_t));
+	/* RFC 1191: path MTU discovery needs the next-hop MTU */
+	icmp_output(out, iface, type, code, 0,
+		    type == ICMP_UNREACHABLE && code == ICMP_UNREACH_NEEDFRAG
+		    ? htons(CONFIG_IP_MTU) : 0, &data, IP_DF);
+ end:
+	pkt_free(pkt);
+}
+#else
+#define ip_forward_error(pkt, iface, len, type, code) pkt_free(pkt)
 #endif
+
+/* returns -1 if the datagram is for one of our other addresses */
+static int ip_forward(pkt_t *pkt, iface_t *iface, uint16_t len)
+{
+	ip_hdr_t *ip = btod(pkt);
+	/* ttl and protocol share a 16-bit word */
+	uint16_t *ttl_p = (uint16_t *)&ip->ttl;
+	uint16_t old_ttl_p;
+	uint32_t next_hop;
+	iface_t *out;
+
+	if ((out = ip_route(ip->dst, NULL, &next_hop)) == NULL) {
+		ip_forward_error(pkt, iface, len, ICMP_UNREACHABLE,
+				 ICMP_UNREACH_NET);
+		return 0;
+	}
+	if (ip->dst == *(uint32_t *)out->ip4_addr)
+		return -1;
+	if (ip_is_broadcast(ip->dst, out)) {
+		pkt_free(pkt);
+		return 0;
+	}
+
+	if (ip->ttl <= 1) {
+		ip_forward_error(pkt, iface, len, ICMP_TIMXCEED,
+				 ICMP_TIMXCEED_INTRANS);
+		return 0;
+	}
+	old_ttl_p = *ttl_p;
+	ip->ttl--;
+	ip->chksum = cksum_update16(ip->chksum, old_ttl_p, *ttl_p);
+
+	/* remove the link layer padding */
+	pkt->buf.len = len;
+#ifdef CONFIG_IP_FRAG
+	if (len > CONFIG_IP_MTU) {
+		if (ip->off & IP_DF) {
+			ip_forward_error(pkt, iface, len, ICMP_UNREACHABLE,
+					 ICMP_UNREACH_NEEDFRAG);
+			return 0;
+		}
+		ip_fragment(pkt, out, &next_hop);
+		return 0;
+	}
 #endif
-#ifdef CONFIG_TCP
-	case IPPROTO_TCP:
-		tcp_input(pkt);
-		return;
+	out->if_output(pkt, out, L3_PROTO_IP, &next_hop);
+	return 0;
+}
 #endif
-#ifdef CONFIG_UDP
-	case IPPROTO_UDP:
-		udp_input(pkt, iface);
-		return;
+
+void ip_input(pkt_t *pkt, iface_t *iface)
+{
+	ip_info_t info;
+	ip_hdr_t *ip = btod(pkt);
+	uint32_t *ip_addr = (uint32_t *)iface->ip4_addr;
+	uint16_t len;
+	ip_proto_t *ip_proto;
+
+	if (ip->v != 4 || ip->ttl == 0)
+		goto error;
+
+	if (ip->hl < IP_MIN_HDR_LEN)
+		goto error;
+
+	info.hdr_len = ip->hl * 4;
+	len = ntohs(ip->len);
+	if (len < info.hdr_len || len > pkt_len(pkt))
+		goto error;
+
+	if (ip_hdr_cksum(ip, info.hdr_len) != 0)
+		goto error;
+
+	if (ip->dst != *ip_addr) {
+#ifdef CONFIG_IP_FORWARD
+		if (ip_is_broadcast(ip->dst, iface))
+			goto error;
+		if (ip_forward(pkt, iface, len) == 0)
+			return;
+#else
+		goto error;
 #endif
-	default:
+	}
+
+	if ((ip_proto = ip_proto_lookup(ip->p)) == NULL) {
 		/* unsupported protocols */
-		break;
+		goto error;
 	}
+	info.hdr = ip;
+	info.plen = len - info.hdr_len;
+	if (ip->off & (IP_MF | htons(IP_OFFMASK))) {
+#ifdef CONFIG_IP_FRAG
+		if ((pkt = ip_reass(pkt, &info)) == NULL)
+			return;
+#else
+		/* ip fragmentation is unsupported */
+		goto error;
+#endif
+	}
+	ip_proto->handler(pkt, iface, &info);
+	return;
 
  error:
 	pkt_free(pkt);
 	/* inc stats */
 }
+
+int ip_register_proto(uint8_t proto, ip_proto_handler_t handler)
+{
+	ip_proto_t *ip_proto;
+
+	if (handler == NULL || ip_proto_lookup(proto))
+		return -1;
+	for (ip_proto = ip_protos; ip_proto < ip_protos + countof(ip_protos);
+	     ip_proto++) {
+		if (ip_proto->handler == NULL) {
+			ip_proto->proto = proto;
+			ip_proto->handler = handler;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int ip_unregister_proto(uint8_t proto)
+{
+	ip_proto_t *ip_proto = ip_proto_lookup(proto);
+
+	if (ip_proto == NULL)
+		return -1;
+	ip_proto->handler = NULL;
+	return 0;
+}
@@ -25,6 +25,7 @@
 #ifndef _IP_H_
 #define _IP_H_
 
+#include <sys/chksum.h>
 #include "config.h"
 
 struct ip_hdr {
@@ -67,7 +68,129 @@ typedef struct ip_hdr ip_hdr_t;
 #define CONFIG_IP_TTL 0x38
 #endif
 
+/* size of the protocol handler table, built-in protocols included */
+#ifndef CONFIG_IP_PROTO_NB
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_IP_PROTO_NB 4
+#else
+#define CONFIG_IP_PROTO_NB 8
+#endif
+#endif
+
+#ifdef CONFIG_IP_FRAG
+/* largest datagram sent without fragmentation, link header excluded */
+#ifndef CONFIG_IP_MTU
+#define CONFIG_IP_MTU (CONFIG_PKT_SIZE - 14)
+#endif
+
+/* number of datagrams reassembled at once */
+#ifndef CONFIG_IP_REASS_NB
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_IP_REASS_NB 1
+#else
+#define CONFIG_IP_REASS_NB 4
+#endif
+#endif
+
+/* unit: s */
+#ifndef CONFIG_IP_REASS_TIMEOUT
+#define CONFIG_IP_REASS_TIMEOUT 15
+#endif
+#endif
+
+/** IPv4 header validated by ip_input()
+ */
+typedef struct ip_info {
+	ip_hdr_t *hdr;
+	uint16_t hdr_len; /* header length in bytes */
+	uint16_t plen;    /* payload length in bytes */
+} ip_info_t;
+
+/** IP protocol handler
+ *
+ * The handler owns the packet. Its data points to the IP header.
+ * A reassembled datagram is a packet chain: the first packet holds the
+ * IP header and the first fragment, the following ones only carry
+ * payload. The chain is freed with pkt_chain_free().
+ */
+typedef void (*ip_proto_handler_t)(pkt_t *pkt, iface_t *iface,
+				   const ip_info_t *info);
+
+/** Compute the checksum of an IPv4 header
+ *
+ * Headers without options are summed with unrolled 16-bit additions.
+ *
+ * @param[in] ip   IP header
+ * @param[in] len  header length in bytes
+ * @return checksum, 0 if the header checksum field is valid
+ */
+static inline uint16_t ip_hdr_cksum(const ip_hdr_t *ip, uint16_t len)
+{
+	const uint16_t *w = (const uint16_t *)ip;
+	uint32_t sum;
+
+	if (len != sizeof(ip_hdr_t))
+		return cksum(ip, len);
+
+	sum = (uint32_t)w[0] + w[1] + w[2] + w[3] + w[4];
+	sum += (uint32_t)w[5] + w[6] + w[7] + w[8] + w[9];
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum += sum >> 16;
+	return ~sum;
+}
+
 void ip_input(pkt_t *pkt, iface_t *iface);
 int ip_output(pkt_t *out, iface_t *iface, uint16_t flags);
 
+#ifdef CONFIG_IP_FRAG
+/** Queue a fragment for reassembly
+ *
+ * Fragments are kept in packet chains, at most CONFIG_IP_REASS_NB
+ * datagrams are reassembled at once. Incomplete datagrams are dropped
+ * after CONFIG_IP_REASS_TIMEOUT seconds. The datagram is returned as
+ * the chain of its fragments, see ip_proto_handler_t.
+ *
+ * @param[in]     pkt   fragment, data pointing to the IP header
+ * @param[in,out] info  fragment header, updated to the datagram one
+ * @return reassembled datagram or NULL if it is not complete
+ */
+pkt_t *ip_reass(pkt_t *pkt, ip_info_t *info);
+
+/** Drop the datagrams being reassembled
+ */
+void ip_reass_shutdown(void);
+
+/** Send a datagram in fragments of at most CONFIG_IP_MTU bytes
+ *
+ * The IP header of the first packet is copied to each fragment,
+ * without its options which are only kept in the first one. The
+ * datagram may itself be a fragment.
+ * Packets of a chain are sent as separate fragments, all of them but
+ * the last one must have a payload length multiple of 8. Packets
+ * larger than CONFIG_IP_MTU are split.
+ *
+ * @param[in] out    IP packet or packet chain
+ * @param[in] iface  interface
+ * @param[in] dst    next hop address
+ * @return 0 on success, -1 on failure
+ */
+int ip_fragment(pkt_t *out, iface_t *iface, const uint32_t *dst);
+#endif
+
+/** Register an IP protocol handler
+ *
+ * @param[in] proto    IP protocol number
+ * @param[in] handler  handler
+ * @return 0 on success, -1 if the protocol is already registered or
+ *         if the table is full
+ */
+int ip_register_proto(uint8_t proto, ip_proto_handler_t handler);
+
+/** Unregister an IP protocol handler
+ *
+ * @param[in] proto  IP protocol number
+ * @return 0 on success, -1 if the protocol is not registered
+ */
+int ip_unregister_proto(uint8_t proto);
+
 #endif
@@ -22,12 +22,37 @@
  *
 */
 
+#include <string.h>
 #include "pkt-mempool.h"
 #include "event.h"
 
-STATIC_RING_DECL(pkt_pool, CONFIG_PKT_NB_MAX);
+/* packet indexes: large packets first, then medium and small ones */
+#define PKT_MEDIUM_FIRST CONFIG_PKT_NB_MAX
+#define PKT_SMALL_FIRST (PKT_MEDIUM_FIRST + CONFIG_PKT_MEDIUM_NB_MAX)
+#define PKT_NB_TOTAL (PKT_SMALL_FIRST + CONFIG_PKT_SMALL_NB_MAX)
+
+/* a ring holds size - 1 entries, make room for all the packets */
+STATIC_RING_DECL(pkt_pool, PKT_RING_SIZE(2 * CONFIG_PKT_NB_MAX));
 static uint8_t buffer_data[CONFIG_PKT_NB_MAX * CONFIG_PKT_SIZE];
-static pkt_t buffer_pool[CONFIG_PKT_NB_MAX];
+#if CONFIG_PKT_MEDIUM_NB_MAX > 0
+STATIC_RING_DECL(pkt_pool_medium, PKT_RING_SIZE(2 * CONFIG_PKT_MEDIUM_NB_MAX));
+static uint8_t
+buffer_data_medium[CONFIG_PKT_MEDIUM_NB_MAX * CONFIG_PKT_MEDIUM_SIZE];
+#endif
+#if CONFIG_PKT_SMALL_NB_MAX > 0
+STATIC_RING_DECL(pkt_pool_small, PKT_RING_SIZE(2 * CONFIG_PKT_SMALL_NB_MAX));
+static uint8_t
+buffer_data_small[CONFIG_PKT_SMALL_NB_MAX * CONFIG_PKT_SMALL_SIZE];
+#endif
+static pkt_t buffer_pool[PKT_NB_TOTAL];
+
+/* disabled classes have a null size */
+static const uint16_t pkt_class_sizes[PKT_CLASS_NB] = {
+	[PKT_CLASS_SMALL] = CONFIG_PKT_SMALL_NB_MAX ? CONFIG_PKT_SMALL_SIZE : 0,
+	[PKT_CLASS_MEDIUM] = CONFIG_PKT_MEDIUM_NB_MAX ?
+	CONFIG_PKT_MEDIUM_SIZE : 0,
+	[PKT_CLASS_LARGE] = CONFIG_PKT_SIZE,
+};
 
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 static pkt_t emergency_pkt;
@@ -39,9 +64,108 @@ int pkt_is_emergency(pkt_t *pkt)
 }
 #endif
 
+static ring_t *pkt_class_pool(uint8_t cls)
+{
+	switch (cls) {
+#if CONFIG_PKT_SMALL_NB_MAX > 0
+	case PKT_CLASS_SMALL:
+		return pkt_pool_small;
+#endif
+#if CONFIG_PKT_MEDIUM_NB_MAX > 0
+	case PKT_CLASS_MEDIUM:
+		return pkt_pool_medium;
+#endif
+	case PKT_CLASS_LARGE:
+		return pkt_pool;
+	default:
+		return NULL;
+	}
+}
+
+static inline ring_t *pkt_pool_of(const pkt_t *pkt)
+{
+	if (pkt->offset >= PKT_SMALL_FIRST)
+		return pkt_class_pool(PKT_CLASS_SMALL);
+	if (pkt->offset >= PKT_MEDIUM_FIRST)
+		return pkt_class_pool(PKT_CLASS_MEDIUM);
+	return pkt_pool;
+}
+
 unsigned int pkt_pool_get_nb_free(void)
 {
-	return ring_len(pkt_pool);
+	return pkt_ring_len(pkt_pool);
+}
+
+unsigned int pkt_pool_class_get_nb_free(uint8_t cls)
+{
+	ring_t *pool = pkt_class_pool(cls);
+
+	if (pool == NULL)
+		return 0;
+	return pkt_ring_len(pool);
+}
+
+int pkt_class_size(uint8_t cls)
+{
+	if (cls >= PKT_CLASS_NB)
+		return 0;
+	return pkt_class_sizes[cls];
+}
+
+/* Indexes wider than a byte are published at once so that a consumer
+ * never sees a partially written index. Ring sizes are multiples of
+ * the index size, an index never wraps around the ring.
+ */
+static inline int pkt_ring_add(ring_t *ring, pkt_idx_t idx)
+{
+#if CONFIG_PKT_IDX_WIDTH == 8
+	return ring_addc(ring, idx);
+#else
+	if (pkt_ring_is_full(ring))
+		return -1;
+	memcpy(&ring->data[ring->head], &idx, sizeof(idx));
+	ring->head = (ring->head + sizeof(idx)) & ring->mask;
+	return 0;
+#endif
+}
+
+static inline int pkt_ring_get(ring_t *ring, pkt_idx_t *idx)
+{
+#if CONFIG_PKT_IDX_WIDTH == 8
+	return ring_getc(ring, idx);
+#else
+	if (ring_is_empty(ring))
+		return -1;
+	memcpy(idx, &ring->data[ring->tail], sizeof(*idx));
+	ring->tail = (ring->tail + sizeof(*idx)) & ring->mask;
+	return 0;
+#endif
+}
+
+/* smallest fitting class first, then the larger ones */
+#if defined(PKT_TRACE) || defined(PKT_DEBUG)
+static pkt_t *pkt_get_size(int len, const char *func, int line)
+#else
+static pkt_t *pkt_get_size(int len)
+#endif
+{
+	uint8_t cls;
+
+	for (cls = 0; cls < PKT_CLASS_NB; cls++) {
+		ring_t *pool = pkt_class_pool(cls);
+		pkt_t *pkt;
+
+		if (pool == NULL || pkt_class_sizes[cls] < len)
+			continue;
+#if defined(PKT_TRACE) || defined(PKT_DEBUG)
+		pkt = __pkt_get(pool, func, line);
+#else
+		pkt = pkt_get(pool);
+#endif
+		if (pkt)
+			return pkt;
+	}
+	return NULL;
 }
 
 #if defined(PKT_TRACE) || defined(PKT_DEBUG)
@@ -50,7 +174,7 @@ void pkt_get_traced_pkts(void)
 	int i;
 
 	DEBUG_LOG("\nLast used functions:\n");
-	for (i = 0; i < CONFIG_PKT_NB_MAX - 1; i++) {
+	for (i = 0; i < PKT_NB_TOTAL; i++) {
 		pkt_t *pkt = &buffer_pool[i];
 
 		DEBUG_LOG("[%d] pkt:%p get:%s put:%s\n",
@@ -62,8 +186,8 @@ void pkt_get_traced_pkts(void)
 
 pkt_t *__pkt_get(ring_t *ring, const char *func, int line)
 {
-	uint8_t offset;
-	int ret = ring_getc(ring, &offset);
+	pkt_idx_t offset;
+	int ret = pkt_ring_get(ring, &offset);
 	pkt_t *pkt;
 
 	if (ret < 0) {
@@ -73,7 +197,7 @@ pkt_t *__pkt_get(ring_t *ring, const char *func, int line)
 		return NULL;
 	}
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
-	if (offset == (typeof(offset))-1) {
+	if (offset == PKT_IDX_EMERGENCY) {
 		DEBUG_LOG("%s() in %s:%d (pkt:%p emergency pkt) failed\n",
 			  __func__, func, line, &emergency_pkt);
 		return &emergency_pkt;
@@ -89,7 +213,7 @@ pkt_t *__pkt_get(ring_t *ring, const char *func, int line)
 
 int __pkt_put(ring_t *ring, pkt_t *pkt, const char *func, int line)
 {
-	int ret = ring_addc(ring, pkt->offset);
+	int ret = pkt_ring_add(ring, pkt->offset);
 #ifdef PKT_DEBUG
 	DEBUG_LOG("%s() in %s:%d (pkt:%p) %s\n", __func__, func, line, pkt,
 		  ret < 0 ? "failed" : "");
@@ -114,6 +238,22 @@ pkt_t *__pkt_alloc(const char *func, int line)
 	return pkt;
 }
 
+pkt_t *__pkt_alloc_size(int len, const char *func, int line)
+{
+	pkt_t *pkt = pkt_get_size(len, func, line);
+
+	if (pkt == NULL)
+		return NULL;
+	/* detect double free */
+	assert(pkt->refcnt == 0);
+
+	pkt->refcnt++;
+#ifdef PKT_DEBUG
+	DEBUG_LOG("%s() in %s:%d (pkt:%p len:%d)\n", __func__, func, line,
+		  pkt, len);
+#endif
+	return pkt;
+}
 
 void __pkt_free(pkt_t *pkt, const char *func, int line)
 {
@@ -132,7 +272,10 @@ void __pkt_free(pkt_t *pkt, const char *func, int line)
 	DEBUG_LOG("%s() in %s:%d (pkt:%p)\n", __func__, func, line, pkt);
 #endif
 	buf_reset(&pkt->buf);
-	if (pkt_put(pkt_pool, pkt) < 0)
+#ifdef PKT_PAYLOAD_CSUM
+	pkt->csum = 0;
+#endif
+	if (pkt_put(pkt_pool_of(pkt), pkt) < 0)
 		__abort();
 #ifdef CONFIG_EVENT
 	event_resume_write_events();
@@ -141,13 +284,13 @@ void __pkt_free(pkt_t *pkt, const char *func, int line)
 #else
 pkt_t *pkt_get(ring_t *ring)
 {
-	uint8_t offset;
-	int ret = ring_getc(ring, &offset);
+	pkt_idx_t offset;
+	int ret = pkt_ring_get(ring, &offset);
 
 	if (ret < 0)
 		return NULL;
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
-	if (offset == (typeof(offset))-1)
+	if (offset == PKT_IDX_EMERGENCY)
 		return &emergency_pkt;
 #endif
 	return &buffer_pool[offset];
@@ -155,7 +298,7 @@ pkt_t *pkt_get(ring_t *ring)
 
 int pkt_put(ring_t *ring, pkt_t *pkt)
 {
-	return ring_addc(ring, pkt->offset);
+	return pkt_ring_add(ring, pkt->offset);
 }
 
 pkt_t *pkt_alloc(void)
@@ -175,6 +318,23 @@ pkt_t *pkt_alloc(void)
 #endif
 }
 
+pkt_t *pkt_alloc_size(int len)
+{
+#ifdef DEBUG
+	pkt_t *pkt = pkt_get_size(len);
+
+	if (pkt == NULL)
+		return NULL;
+	/* detect double free */
+	assert(pkt->refcnt == 0);
+
+	pkt->refcnt++;
+	return pkt;
+#else
+	return pkt_get_size(len);
+#endif
+}
+
 void pkt_free(pkt_t *pkt)
 {
 #ifdef DEBUG
@@ -191,11 +351,14 @@ void pkt_free(pkt_t *pkt)
 	}
 #endif
 	buf_reset(&pkt->buf);
+#ifdef PKT_PAYLOAD_CSUM
+	pkt->csum = 0;
+#endif
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	if (pkt_is_emergency(pkt))
 		return;
 #endif
-	if (pkt_put(pkt_pool, pkt) < 0)
+	if (pkt_put(pkt_pool_of(pkt), pkt) < 0)
 		__abort();
 #ifdef CONFIG_EVENT
 	event_resume_write_events();
@@ -204,9 +367,21 @@ void pkt_free(pkt_t *pkt)
 
 #endif
 
-static void pkt_init_pkt(pkt_t *pkt, uint8_t *data)
+void pkt_chain_free(pkt_t *pkt)
+{
+	pkt_t *frag;
+
+	while ((frag = pkt_chain_pop(&pkt)))
+		pkt_free(frag);
+}
+
+static void pkt_init_pkt(pkt_t *pkt, uint8_t *data, int size)
 {
-	pkt->buf = BUF_INIT(data, CONFIG_PKT_SIZE);
+	pkt->buf = BUF_INIT(data, size);
+	pkt->next = NULL;
+#ifdef PKT_PAYLOAD_CSUM
+	pkt->csum = 0;
+#endif
 	pkt->refcnt = 0;
 
 	INIT_LIST_HEAD(&pkt->list);
@@ -221,25 +396,56 @@ pkt_t *pkt_alloc_emergency(void)
 {
 	assert(emergency_pkt.refcnt == 0);
 	emergency_pkt.refcnt++;
+#ifdef PKT_PAYLOAD_CSUM
+	emergency_pkt.csum = 0;
+#endif
 	return &emergency_pkt;
 }
 #endif
 
-void pkt_mempool_init(void)
+static void pkt_init_class(ring_t *pool, uint8_t *data, int size,
+			   unsigned first, unsigned nb)
 {
 	unsigned i;
 
-	for (i = 0; i < CONFIG_PKT_NB_MAX - 1; i++) {
-		pkt_t *pkt = &buffer_pool[i];
+	for (i = 0; i < nb; i++) {
+		pkt_t *pkt = &buffer_pool[first + i];
 
-		assert(i < (typeof(pkt->offset))(-1));
-		pkt_init_pkt(pkt, &buffer_data[i * CONFIG_PKT_SIZE]);
-		pkt->offset = i;
-		ring_addc(pkt_pool, i);
+		pkt_init_pkt(pkt, &data[i * size], size);
+		pkt->offset = first + i;
+		pkt_ring_add(pool, first + i);
 	}
+}
+
+void pkt_mempool_init(void)
+{
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
-	pkt_init_pkt(&emergency_pkt, (uint8_t *)&emergency_pkt + sizeof(pkt_t));
-	emergency_pkt.offset = -1;
+	STATIC_ASSERT(PKT_NB_TOTAL - 1 < PKT_IDX_EMERGENCY);
+#else
+	STATIC_ASSERT(PKT_NB_TOTAL - 1 <= PKT_IDX_EMERGENCY);
+#endif
+
+	pkt_init_class(pkt_pool, buffer_data, CONFIG_PKT_SIZE, 0,
+		       CONFIG_PKT_NB_MAX);
+#if CONFIG_PKT_MEDIUM_NB_MAX > 0
+	STATIC_ASSERT(CONFIG_PKT_MEDIUM_SIZE < CONFIG_PKT_SIZE);
+	pkt_init_class(pkt_pool_medium, buffer_data_medium,
+		       CONFIG_PKT_MEDIUM_SIZE, PKT_MEDIUM_FIRST,
+		       CONFIG_PKT_MEDIUM_NB_MAX);
+#endif
+#if CONFIG_PKT_SMALL_NB_MAX > 0
+	STATIC_ASSERT(CONFIG_PKT_SMALL_SIZE < CONFIG_PKT_SIZE);
+#if CONFIG_PKT_MEDIUM_NB_MAX > 0
+	STATIC_ASSERT(CONFIG_PKT_SMALL_SIZE < CONFIG_PKT_MEDIUM_SIZE);
+#endif
+	pkt_init_class(pkt_pool_small, buffer_data_small,
+		       CONFIG_PKT_SMALL_SIZE, PKT_SMALL_FIRST,
+		       CONFIG_PKT_SMALL_NB_MAX);
+#endif
+#ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
+	pkt_init_pkt(&emergency_pkt, (uint8_t *)&emergency_pkt + sizeof(pkt_t),
+		     CONFIG_PKT_SIZE);
+	emergency_pkt.offset = PKT_IDX_EMERGENCY;
 #endif
 }
 
@@ -247,5 +453,11 @@ void pkt_mempool_init(void)
 void pkt_mempool_shutdown(void)
 {
 	ring_reset(pkt_pool);
+#if CONFIG_PKT_MEDIUM_NB_MAX > 0
+	ring_reset(pkt_pool_medium);
+#endif
+#if CONFIG_PKT_SMALL_NB_MAX > 0
+	ring_reset(pkt_pool_small);
+#endif
 }
 #endif
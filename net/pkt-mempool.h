@@ -29,13 +29,54 @@
 #include "../sys/buf.h"
 #include "../sys/ring.h"
 #include "../sys/list.h"
+#include "../sys/chksum.h"
 
 /* #define PKT_TRACE */
 
+/* packet index width in bits (8, 16 or 32) */
+#ifndef CONFIG_PKT_IDX_WIDTH
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_PKT_IDX_WIDTH 8
+#else
+#define CONFIG_PKT_IDX_WIDTH 16
+#endif
+#endif
+
+#if CONFIG_PKT_IDX_WIDTH == 8
+typedef uint8_t pkt_idx_t;
+#elif CONFIG_PKT_IDX_WIDTH == 16
+typedef uint16_t pkt_idx_t;
+#elif CONFIG_PKT_IDX_WIDTH == 32
+typedef uint32_t pkt_idx_t;
+#else
+#error "CONFIG_PKT_IDX_WIDTH must be 8, 16 or 32"
+#endif
+
+/* Keep the checksum of the payload summed while it is copied into a
+ * packet so that it is not read again on output. Saves RAM on AVR.
+ */
+#ifndef CONFIG_AVR_MCU
+#define PKT_PAYLOAD_CSUM
+#endif
+
+/* reserved for the emergency packet */
+#define PKT_IDX_EMERGENCY ((pkt_idx_t)-1)
+
+/** Size of a packet ring
+ *
+ * Packet rings store packet indexes. A ring of PKT_RING_SIZE(nb) bytes
+ * holds up to nb - 1 packets.
+ */
+#define PKT_RING_SIZE(nb) ((nb) * sizeof(pkt_idx_t))
+
 struct pkt {
 	buf_t buf;
 	list_t list;
-	uint8_t offset;
+	struct pkt *next; /* next fragment of a packet chain */
+	pkt_idx_t offset;
+#ifdef PKT_PAYLOAD_CSUM
+	uint16_t csum; /* folded payload checksum, 0 if not computed */
+#endif
 	uint8_t refcnt;
 #if defined(PKT_TRACE) || defined(PKT_DEBUG)
 	const char *last_get_func;
@@ -61,6 +102,34 @@ typedef struct pkt pkt_t;
 #define CONFIG_PKT_SIZE 128
 #endif
 
+/* Optional size classes for packets smaller than CONFIG_PKT_SIZE.
+ * A class is disabled when its number of packets is 0.
+ */
+#ifndef CONFIG_PKT_SMALL_NB_MAX
+#define CONFIG_PKT_SMALL_NB_MAX 0
+#endif
+#ifndef CONFIG_PKT_SMALL_SIZE
+#define CONFIG_PKT_SMALL_SIZE 128
+#endif
+#ifndef CONFIG_PKT_MEDIUM_NB_MAX
+#define CONFIG_PKT_MEDIUM_NB_MAX 0
+#endif
+#ifndef CONFIG_PKT_MEDIUM_SIZE
+#define CONFIG_PKT_MEDIUM_SIZE 512
+#endif
+
+/** Packet size classes
+ *
+ * PKT_CLASS_LARGE packets are CONFIG_PKT_SIZE bytes long and are the
+ * ones returned by pkt_alloc().
+ */
+enum pkt_class {
+	PKT_CLASS_SMALL,
+	PKT_CLASS_MEDIUM,
+	PKT_CLASS_LARGE,
+	PKT_CLASS_NB,
+};
+
 /** Initialize packet memory pool
  */
 void pkt_mempool_init(void);
@@ -79,8 +148,10 @@ int __pkt_put(ring_t *ring, pkt_t *pkt, const char *func, int line);
 #define pkt_put(ring, pkt) __pkt_put(ring, pkt, __func__, __LINE__)
 
 pkt_t *__pkt_alloc(const char *func, int line);
+pkt_t *__pkt_alloc_size(int len, const char *func, int line);
 void __pkt_free(pkt_t *pkt, const char *func, int line);
 #define pkt_alloc() __pkt_alloc(__func__, __LINE__)
+#define pkt_alloc_size(len) __pkt_alloc_size(len, __func__, __LINE__)
 #define pkt_free(pkt) __pkt_free(pkt, __func__, __LINE__)
 #else
 
@@ -106,6 +177,16 @@ int pkt_put(ring_t *ring, pkt_t *pkt);
  */
 pkt_t *pkt_alloc(void);
 
+/** Allocate a packet of at least len bytes
+ *
+ * The packet is taken from the smallest size class that fits len.
+ * Larger classes are tried if this one is exhausted.
+ * Note: Allocs and frees can only be called from a task scheduler
+ * @param[in] len  minimum packet size
+ * @return new packet or NULL if no more packets
+ */
+pkt_t *pkt_alloc_size(int len);
+
 /** Free a packet
  *
  * Note: Allocs and frees can only be called from a task scheduler
@@ -153,12 +234,162 @@ static inline void pkt_retain(pkt_t *pkt)
 	pkt->refcnt++;
 }
 
+/** Get length of a packet chain
+ *
+ * @param[in] pkt  first fragment
+ * @return total length of the fragments
+ */
+static inline int pkt_chain_len(const pkt_t *pkt)
+{
+	int len = 0;
+
+	for (; pkt; pkt = pkt->next)
+		len += pkt_len(pkt);
+	return len;
+}
+
+/** Append a packet to a packet chain
+ *
+ * @param[in,out] head  first fragment, NULL for an empty chain
+ * @param[in]     pkt   packet or packet chain to append
+ */
+static inline void pkt_chain_append(pkt_t **head, pkt_t *pkt)
+{
+	while (*head)
+		head = &(*head)->next;
+	*head = pkt;
+}
+
+/** Detach the first fragment of a packet chain
+ *
+ * @param[in,out] head  first fragment, updated to the next one
+ * @return detached fragment or NULL if the chain is empty
+ */
+static inline pkt_t *pkt_chain_pop(pkt_t **head)
+{
+	pkt_t *pkt = *head;
+
+	if (pkt) {
+		*head = pkt->next;
+		pkt->next = NULL;
+	}
+	return pkt;
+}
+
+/** Adjust a packet chain
+ *
+ * A negative length is applied to the first fragment (header room),
+ * a positive one removes data from the front of the chain and may
+ * empty several fragments.
+ * @param[in] pkt  first fragment
+ * @param[in] len  length
+ */
+static inline void pkt_chain_adj(pkt_t *pkt, int len)
+{
+	if (len < 0) {
+		pkt_adj(pkt, len);
+		return;
+	}
+	for (; pkt && len; pkt = pkt->next) {
+		int n = len < pkt_len(pkt) ? len : pkt_len(pkt);
+
+		pkt_adj(pkt, n);
+		len -= n;
+	}
+}
+
+/** Compute the partial checksum of a packet chain
+ *
+ * Fragments may have odd lengths.
+ * @param[in] pkt  first fragment
+ * @return partial checksum, see cksum_partial()
+ */
+static inline uint32_t pkt_chain_cksum_partial(const pkt_t *pkt)
+{
+	uint32_t csum = 0;
+	uint8_t odd = 0;
+
+	for (; pkt; pkt = pkt->next) {
+		uint32_t sum = cksum_partial(pkt->buf.data, pkt_len(pkt));
+
+		/* a fragment starting on an odd byte is summed swapped */
+		if (odd) {
+			sum = (sum >> 16) + (sum & 0xffff);
+			sum += sum >> 16;
+			sum = ((sum << 8) | ((sum >> 8) & 0xff)) & 0xffff;
+		}
+		csum += sum;
+		odd ^= pkt_len(pkt) & 1;
+	}
+	return csum;
+}
+
+/** Free a packet chain
+ *
+ * @param[in] pkt  first fragment, may be NULL
+ */
+void pkt_chain_free(pkt_t *pkt);
+
+/** Copy the data of a packet chain to its first fragment
+ *
+ * The following fragments are freed on success.
+ * @param[in] pkt  first fragment
+ * @return 0 on success, -1 if the data does not fit in the first fragment
+ */
+static inline int pkt_chain_linearize(pkt_t *pkt)
+{
+	pkt_t *frag;
+
+	if (buf_has_room(&pkt->buf, pkt_chain_len(pkt->next)) < 0)
+		return -1;
+	while ((frag = pkt_chain_pop(&pkt->next))) {
+		__buf_add(&pkt->buf, frag->buf.data, pkt_len(frag));
+		pkt_free(frag);
+	}
+	return 0;
+}
+
+/** Get number of packets in a packet ring
+ *
+ * @param[in] ring  packet ring
+ * @return number of packets
+ */
+static inline int pkt_ring_len(const ring_t *ring)
+{
+	return ring_len(ring) / sizeof(pkt_idx_t);
+}
+
+/** Check if a packet ring is full
+ *
+ * @param[in] ring  packet ring
+ * @return 1 if full, 0 otherwise
+ */
+static inline uint8_t pkt_ring_is_full(const ring_t *ring)
+{
+	return ring_free_entries(ring) < (int)sizeof(pkt_idx_t);
+}
+
 /** Get number of available packets
  *
+ * Only PKT_CLASS_LARGE packets are accounted.
  * @return number of available packets
  */
 unsigned int pkt_pool_get_nb_free(void);
 
+/** Get number of available packets in a size class
+ *
+ * @param[in] cls  size class
+ * @return number of available packets, 0 if the class is disabled
+ */
+unsigned int pkt_pool_class_get_nb_free(uint8_t cls);
+
+/** Get packet size of a size class
+ *
+ * @param[in] cls  size class
+ * @return packet size, 0 if the class is disabled
+ */
+int pkt_class_size(uint8_t cls);
+
 /** Get last used functions of packets in pool (for debugging)
  */
 void pkt_get_traced_pkts(void);
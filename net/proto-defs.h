@@ -112,5 +112,7 @@
 #define		ICMP_UNREACH_HOST_PRECEDENCE 14	  /* host prec vio. */
 #define		ICMP_UNREACH_PRECEDENCE_CUTOFF 15 /* prec cutoff */
 #define ICMP_ECHO 8
+#define	ICMP_TIMXCEED		11	  /* time exceeded, code: */
+#define		ICMP_TIMXCEED_INTRANS	0	  /* ttl==0 in transit */
 
 #endif
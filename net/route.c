@@ -24,9 +24,192 @@
 
 #include "route.h"
 
-/* allow only one route, the default one */
+/* the default route is used if no other route matches */
 route_t dft_route;
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+typedef struct route_cache_entry {
+	uint32_t dst;
+	const route_entry_t *rt; /* NULL if no route matches */
+} route_cache_entry_t;
+
+/* routes of a prefix length */
+typedef struct route_group {
+	uint8_t start;
+	uint8_t nb;
+} route_group_t;
+
+/* sorted by decreasing prefix length, then by network */
+static route_entry_t routes[CONFIG_IP_ROUTE_NB];
+static uint8_t routes_nb;
+static route_group_t route_groups[CONFIG_IP_ROUTE_NB];
+static uint8_t route_groups_nb;
+static route_cache_entry_t route_cache[CONFIG_IP_ROUTE_CACHE_SIZE];
+
+static inline uint32_t route_mask(uint8_t prefix_len)
+{
+	uint32_t mask;
+
+	if (prefix_len == 0)
+		return 0;
+	mask = 0xFFFFFFFFUL << (32 - prefix_len);
+	return htonl(mask);
+}
+
+static inline int
+route_cmp(uint8_t prefix_len, uint32_t net, const route_entry_t *rt)
+{
+	if (prefix_len != rt->prefix_len)
+		return prefix_len > rt->prefix_len ? -1 : 1;
+	if (net != rt->net)
+		return net < rt->net ? -1 : 1;
+	return 0;
+}
+
+/* position of a route or of its insertion point */
+static int route_find(uint8_t prefix_len, uint32_t net, int *pos)
+{
+	int lo = 0, hi = routes_nb;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = route_cmp(prefix_len, net, &routes[mid]);
+
+		if (cmp == 0) {
+			*pos = mid;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*pos = lo;
+	return -1;
+}
+
+/* rebuild the prefix length groups and drop the cached lookups */
+static void route_update(void)
+{
+	int i;
+
+	route_groups_nb = 0;
+	for (i = 0; i < routes_nb; i++) {
+		route_group_t *group = &route_groups[route_groups_nb];
+
+		if (i && routes[i].prefix_len == routes[i - 1].prefix_len) {
+			group[-1].nb++;
+			continue;
+		}
+		group->start = i;
+		group->nb = 1;
+		route_groups_nb++;
+	}
+	memset(route_cache, 0, sizeof(route_cache));
+}
+
+int route_add(uint32_t net, uint8_t prefix_len, uint32_t gw, iface_t *iface)
+{
+	route_entry_t *rt;
+	int pos;
+
+	if (prefix_len > 32 || iface == NULL)
+		return -1;
+	net &= route_mask(prefix_len);
+	if (route_find(prefix_len, net, &pos) < 0) {
+		if (routes_nb >= CONFIG_IP_ROUTE_NB)
+			return -1;
+		memmove(&routes[pos + 1], &routes[pos],
+			(routes_nb - pos) * sizeof(route_entry_t));
+		routes_nb++;
+	}
+	rt = &routes[pos];
+	rt->net = net;
+	rt->mask = route_mask(prefix_len);
+	rt->prefix_len = prefix_len;
+	rt->gw = gw;
+	rt->iface = iface;
+	route_update();
+	return 0;
+}
+
+int route_del(uint32_t net, uint8_t prefix_len)
+{
+	int pos;
+
+	if (prefix_len > 32)
+		return -1;
+	net &= route_mask(prefix_len);
+	if (route_find(prefix_len, net, &pos) < 0)
+		return -1;
+	routes_nb--;
+	memmove(&routes[pos], &routes[pos + 1],
+		(routes_nb - pos) * sizeof(route_entry_t));
+	route_update();
+	return 0;
+}
+
+void route_flush(void)
+{
+	routes_nb = 0;
+	route_update();
+}
+
+/* binary search in each prefix length group, longest first */
+static const route_entry_t *route_lpm(uint32_t dst)
+{
+	int i;
+
+	for (i = 0; i < route_groups_nb; i++) {
+		const route_entry_t *group = &routes[route_groups[i].start];
+		uint32_t net = dst & group->mask;
+		int lo = 0, hi = route_groups[i].nb;
+
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+
+			if (group[mid].net == net)
+				return &group[mid];
+			if (net < group[mid].net)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+static inline uint8_t route_cache_hash(uint32_t dst)
+{
+	dst ^= dst >> 16;
+	dst ^= dst >> 8;
+	return dst & (CONFIG_IP_ROUTE_CACHE_SIZE - 1);
+}
+
+iface_t *route_lookup(uint32_t dst, uint32_t *next_hop)
+{
+	route_cache_entry_t *ce = &route_cache[route_cache_hash(dst)];
+	const route_entry_t *rt;
+
+	STATIC_ASSERT(POWEROF2(CONFIG_IP_ROUTE_CACHE_SIZE));
+
+	/* address 0 is never routed, it marks unused cache entries */
+	if (dst == 0)
+		return NULL;
+	if (ce->dst == dst)
+		rt = ce->rt;
+	else {
+		rt = route_lpm(dst);
+		ce->dst = dst;
+		ce->rt = rt;
+	}
+	if (rt == NULL)
+		return NULL;
+	*next_hop = rt->gw ? rt->gw : dst;
+	return rt->iface;
+}
+#endif
+
 #ifdef CONFIG_IPV6
 route6_t dft_route6;
 #endif
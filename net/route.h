@@ -36,6 +36,67 @@ typedef struct route route_t;
 
 extern route_t dft_route;
 
+#ifdef CONFIG_MORE_THAN_ONE_INTERFACE
+#ifndef CONFIG_IP_ROUTE_NB
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_IP_ROUTE_NB 4
+#else
+#define CONFIG_IP_ROUTE_NB 16
+#endif
+#endif
+
+/* destinations cached, power of 2 */
+#ifndef CONFIG_IP_ROUTE_CACHE_SIZE
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_IP_ROUTE_CACHE_SIZE 4
+#else
+#define CONFIG_IP_ROUTE_CACHE_SIZE 64
+#endif
+#endif
+
+/* addresses are in network byte order */
+typedef struct route_entry {
+	uint32_t net;
+	uint32_t mask;
+	uint32_t gw; /* 0 for directly connected networks */
+	iface_t *iface;
+	uint8_t prefix_len;
+} route_entry_t;
+
+/** Add or update a route
+ *
+ * @param[in] net         network address
+ * @param[in] prefix_len  network prefix length
+ * @param[in] gw          gateway, 0 if the network is directly connected
+ * @param[in] iface       interface
+ * @return 0 on success, -1 if the table is full or on invalid prefix
+ */
+int route_add(uint32_t net, uint8_t prefix_len, uint32_t gw, iface_t *iface);
+
+/** Delete a route
+ *
+ * @param[in] net         network address
+ * @param[in] prefix_len  network prefix length
+ * @return 0 on success, -1 if the route does not exist
+ */
+int route_del(uint32_t net, uint8_t prefix_len);
+
+/** Delete all routes, the default one is kept
+ */
+void route_flush(void);
+
+/** Find the route of a destination
+ *
+ * The longest matching prefix is used. Results are cached per
+ * destination. The default route is not looked up.
+ *
+ * @param[in]  dst       destination address
+ * @param[out] next_hop  gateway or destination address
+ * @return outgoing interface or NULL if no route matches
+ */
+iface_t *route_lookup(uint32_t dst, uint32_t *next_hop);
+#endif
+
 #ifdef CONFIG_IPV6
 struct route6 {
 	uint8_t ip[IP6_ADDR_LEN];
@@ -54,19 +54,6 @@ static HTABLE_DECL(tcp_binds, CONFIG_MAX_SOCK_HT_SIZE);
 #endif
 #endif
 
-static tcp_conn_t *
-socket_lookup_tcp_conn(const listen_t *listen, const tcp_uid_t *uid)
-{
-	tcp_conn_t *tcp_conn;
-
-	list_for_each_entry(tcp_conn, &listen->tcp_conn_list_head,
-			    list) {
-		if (memcmp(uid, &tcp_conn->syn.tuid, sizeof(tcp_uid_t)) == 0)
-			return tcp_conn;
-	}
-	return NULL;
-}
-
 #ifdef CONFIG_EVENT
 void socket_event_register(sock_info_t *sock_info, uint8_t events,
 			   void (*ev_cb)(event_t *ev, uint8_t events))
@@ -213,37 +200,6 @@ static int bind_on_port(uint16_t port, sock_info_t *sock_info)
 	return 0;
 }
 
-typedef struct socket_tcp_conn_lookup_data {
-	tcp_conn_t *tcp_conn;
-	const tcp_uid_t *uid;
-} socket_tcp_conn_lookup_data_t;
-
-static int socket_tcp_conn_lookup_cb(sbuf_t *key, sbuf_t *val, void **arg)
-{
-	sock_info_t *sock_info = SBUF2SOCKINFO(val);
-	socket_tcp_conn_lookup_data_t *data = *arg;
-
-	if (sock_info->listen == NULL)
-		return 0;
-	data->tcp_conn = socket_lookup_tcp_conn(sock_info->listen, data->uid);
-	if (data->tcp_conn)
-		return -1;
-
-	return 0;
-}
-
-tcp_conn_t *socket_tcp_conn_lookup(const tcp_uid_t *uid)
-{
-	socket_tcp_conn_lookup_data_t data = {
-		.tcp_conn = NULL,
-		.uid = uid,
-	};
-	socket_tcp_conn_lookup_data_t *datap = &data;
-
-	htable_for_each(&fd_to_sock, socket_tcp_conn_lookup_cb, (void **)&datap);
-	return data.tcp_conn;
-}
-
 #else  /* CONFIG_HT_STORAGE */
 #ifdef CONFIG_BSD_COMPAT
 static sock_info_t *fd2sockinfo(int fd)
@@ -307,7 +263,7 @@ static int unbind_port(sock_info_t *sock_info)
 					 sock_info->event.rx_queue, list) {
 
 			list_del(&pkt->list);
-			pkt_free(pkt);
+			pkt_chain_free(pkt);
 		}
 	}
 #endif
@@ -329,24 +285,6 @@ static int bind_on_port(uint16_t port, sock_info_t *sock_info)
 	return 0;
 }
 
-#ifdef CONFIG_TCP
-tcp_conn_t *socket_tcp_conn_lookup(const tcp_uid_t *uid)
-{
-	sock_info_t *sock_info;
-
-	list_for_each_entry(sock_info, &sock_list, list) {
-		listen_t *listen = sock_info->listen;
-		tcp_conn_t *tcp_conn;
-
-		if (listen == NULL)
-			continue;
-		tcp_conn = socket_lookup_tcp_conn(sock_info->listen, uid);
-		if (tcp_conn)
-			return tcp_conn;
-	}
-	return NULL;
-}
-#endif
 #endif	/* CONFIG_HT_STORAGE not set */
 
 #ifdef CONFIG_TCP
@@ -695,11 +633,46 @@ sock_info_accept(sock_info_t *sock_info_server, sock_info_t *sock_info_client,
 #endif
 #endif	/* BSD_COMPAT */
 
+#ifdef CONFIG_TCP_RETRANSMIT
+#define SOCKET_PKT_RESERVED_LEN (int)sizeof(tcp_retrn_pkt_t)
+#else
+#define SOCKET_PKT_RESERVED_LEN 0
+#endif
+
+/* room left for the payload in a packet */
+#define SOCKET_PKT_ROOM(hdrlen) (CONFIG_PKT_SIZE - (int)sizeof(eth_hdr_t) \
+				 - (int)sizeof(ip_hdr_t) - (hdrlen)	\
+				 - SOCKET_PKT_RESERVED_LEN)
+
+static void socket_fill_pkt(pkt_t *pkt, int hdrlen, const sbuf_t *sbuf)
+{
+	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
+	pkt_adj(pkt, (int)sizeof(ip_hdr_t));
+	pkt_adj(pkt, hdrlen);
+#ifdef PKT_PAYLOAD_CSUM
+	{
+		uint32_t csum = 0;
+
+		/* the room is checked by the callers */
+		buf_add_and_csum(&pkt->buf, sbuf->data, sbuf->len, &csum);
+		pkt->csum = cksum_fold(csum);
+	}
+#else
+	__buf_add(&pkt->buf, sbuf->data, sbuf->len);
+#endif
+	pkt_adj(pkt, -hdrlen);
+}
+
 static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf)
 {
 	pkt_t *pkt;
-	int needed_pkt_size = sbuf->len + hdrlen;
 
+	if (sbuf->len > SOCKET_PKT_ROOM(hdrlen)) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EMSGSIZE;
+#endif
+		return NULL;
+	}
 	if ((pkt = pkt_alloc()) == NULL
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	    && (pkt = pkt_alloc_emergency()) == NULL
@@ -710,28 +683,99 @@ static pkt_t *socket_alloc_pkt(int hdrlen, const sbuf_t *sbuf)
 #endif
 		return NULL;
 	}
+	socket_fill_pkt(pkt, hdrlen, sbuf);
+	return pkt;
+}
+
+#if defined(CONFIG_UDP) && defined(CONFIG_IP_FRAG)
+/* Split a datagram larger than a packet into a chain of IP fragments.
+ * Fragment payloads but the last one are multiples of 8 bytes.
+ */
+static pkt_t *socket_alloc_udp_chain(const sbuf_t *sbuf)
+{
+	int frag_len = MIN(SOCKET_PKT_ROOM(0),
+			   CONFIG_IP_MTU - (int)sizeof(ip_hdr_t)) & ~7;
+	int hdrlen = (int)sizeof(udp_hdr_t);
+	pkt_t *head = NULL;
+	pkt_t **tail = &head;
+	sbuf_t seg;
+	int off;
+
+	if (sbuf->len <= SOCKET_PKT_ROOM(hdrlen))
+		return socket_alloc_pkt(hdrlen, sbuf);
+
+	if (sbuf->len + hdrlen > 0xFFFF - (int)sizeof(ip_hdr_t)
+	    || (sbuf->len + hdrlen + frag_len - 1) / frag_len
+	    > CONFIG_PKT_NB_MAX) {
+#ifdef CONFIG_BSD_COMPAT
+		errno = EMSGSIZE;
+#endif
+		return NULL;
+	}
+	for (off = 0; off < sbuf->len; off += seg.len) {
+		pkt_t *pkt;
 
-#ifdef CONFIG_TCP_RETRANSMIT
-	needed_pkt_size += sizeof(tcp_retrn_pkt_t);
+		if ((pkt = pkt_alloc()) == NULL) {
+#ifdef CONFIG_BSD_COMPAT
+			errno = ENOBUFS;
 #endif
-	if (pkt->buf.size < needed_pkt_size) {
+			pkt_chain_free(head);
+			return NULL;
+		}
+		seg.data = sbuf->data + off;
+		seg.len = MIN(frag_len - hdrlen, sbuf->len - off);
+		socket_fill_pkt(pkt, hdrlen, &seg);
+		*tail = pkt;
+		tail = &pkt->next;
+		hdrlen = 0;
+	}
+	return head;
+}
+#endif
+
+#ifdef CONFIG_TCP
+/* Split a write into a chain of MSS sized segments. The whole chain
+ * is allocated before sending so that a write is queued entirely or
+ * not at all.
+ */
+static pkt_t *
+socket_alloc_tcp_chain(const tcp_conn_t *tcp_conn, const sbuf_t *sbuf)
+{
+	int seg_len = MIN(tcp_conn_get_mss(tcp_conn),
+			  SOCKET_PKT_ROOM((int)sizeof(tcp_hdr_t)));
+	pkt_t *head = NULL;
+	pkt_t **tail = &head;
+	sbuf_t seg;
+	int off;
+
+	if (sbuf->len <= seg_len)
+		return socket_alloc_pkt((int)sizeof(tcp_hdr_t), sbuf);
+
+	if ((sbuf->len + seg_len - 1) / seg_len > CONFIG_PKT_NB_MAX) {
 #ifdef CONFIG_BSD_COMPAT
 		errno = EMSGSIZE;
 #endif
-		goto error;
+		return NULL;
 	}
+	for (off = 0; off < sbuf->len; off += seg.len) {
+		pkt_t *pkt;
 
-	pkt_adj(pkt, (int)sizeof(eth_hdr_t));
-	pkt_adj(pkt, (int)sizeof(ip_hdr_t));
-	pkt_adj(pkt, hdrlen);
-	__buf_add(&pkt->buf, sbuf->data, sbuf->len);
-	pkt_adj(pkt, -hdrlen);
-
-	return pkt;
- error:
-	pkt_free(pkt);
-	return NULL;
+		if ((pkt = pkt_alloc()) == NULL) {
+#ifdef CONFIG_BSD_COMPAT
+			errno = ENOBUFS;
+#endif
+			pkt_chain_free(head);
+			return NULL;
+		}
+		seg.data = sbuf->data + off;
+		seg.len = MIN(seg_len, sbuf->len - off);
+		socket_fill_pkt(pkt, (int)sizeof(tcp_hdr_t), &seg);
+		*tail = pkt;
+		tail = &pkt->next;
+	}
+	return head;
 }
+#endif
 
 #ifdef CONFIG_TCP
 static tcp_conn_t *socket_get_tcp_conn(const sock_info_t *sock_info)
@@ -762,6 +806,7 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 	pkt_t *pkt;
 #ifdef CONFIG_TCP
 	tcp_conn_t *tcp_conn;
+	int sent;
 #endif
 	if (sbuf->len == 0)
 		return 0;
@@ -772,6 +817,11 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 		if (sock_info->port == 0 && sock_info_bind(sock_info, 0) < 0)
 			return -1;
 
+#ifdef CONFIG_IP_FRAG
+		/* errno is set by the allocation */
+		if ((pkt = socket_alloc_udp_chain(sbuf)) == NULL)
+			return -1;
+#else
 		pkt = socket_alloc_pkt((int)sizeof(udp_hdr_t), sbuf);
 		if (pkt == NULL) {
 #ifdef CONFIG_BSD_COMPAT
@@ -779,8 +829,11 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 #endif
 			return -1;
 		}
+#endif
 
-		return udp_output(pkt, dst_addr, sock_info->port, dst_port);
+		if (udp_output(pkt, dst_addr, sock_info->port, dst_port) < 0)
+			return -1;
+		return sbuf->len;
 #endif
 #ifdef CONFIG_TCP
 	case SOCK_TYPE_TCP:
@@ -798,23 +851,30 @@ int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 			return -1;
 		}
 
-		pkt = socket_alloc_pkt((int)sizeof(tcp_hdr_t), sbuf);
-		if (pkt == NULL) {
-#ifdef CONFIG_BSD_COMPAT
-			errno = ENOBUFS;
-#endif
+		/* errno is set by the allocation */
+		if ((pkt = socket_alloc_tcp_chain(tcp_conn, sbuf)) == NULL)
 			return -1;
-		}
 
-		if (tcp_output(pkt, tcp_conn, TH_PUSH | TH_ACK) < 0) {
+		sent = 0;
+		while (pkt) {
+			pkt_t *seg = pkt_chain_pop(&pkt);
+			int len = pkt_len(seg) - (int)sizeof(tcp_hdr_t);
+
+			if (tcp_send(tcp_conn, seg) < 0) {
+				/* the failed segment has not consumed any
+				 * sequence space, report what went out */
+				pkt_chain_free(pkt);
+				if (sent)
+					return sent;
 #ifdef CONFIG_BSD_COMPAT
-			errno = EBADF;
+				errno = tcp_snd_queue_is_full(tcp_conn) ?
+					EAGAIN : ENOBUFS;
 #endif
-			return -1;
+				return -1;
+			}
+			sent += len;
 		}
-		tcp_conn->syn.seqid = htonl(ntohl(tcp_conn->syn.seqid) +
-					    sbuf->len);
-		return 0;
+		return sent;
 #endif
 	default:
 #ifdef CONFIG_BSD_COMPAT
@@ -964,16 +1024,20 @@ int socket_get_pkt(int fd, pkt_t **pktp, struct sockaddr_in *addr_in)
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
 		 struct sockaddr *src_addr, socklen_t *addrlen)
 {
-	pkt_t *pkt;
-	int __len;
+	pkt_t *pkt, *frag;
+	int __len = 0;
 
 	(void)flags;
 	if (socket_get_pkt(sockfd, &pkt, (struct sockaddr_in *)src_addr) < 0)
 		return -1;
 	*addrlen = sizeof(struct sockaddr_in);
-	__len = MIN((int)len, pkt->buf.len);
-	memcpy(buf, pkt->buf.data, __len);
-	pkt_free(pkt);
+	for (frag = pkt; frag && __len < (int)len; frag = frag->next) {
+		int n = MIN((int)len - __len, pkt_len(frag));
+
+		memcpy((uint8_t *)buf + __len, frag->buf.data, n);
+		__len += n;
+	}
+	pkt_chain_free(pkt);
 	return __len;
 }
 
@@ -1055,5 +1119,8 @@ void socket_shutdown(void)
 #endif
 		free(sock_info);
 	}
+#ifdef CONFIG_TCP
+	tcp_shutdown();
+#endif
 #endif
 }
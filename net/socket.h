@@ -246,9 +246,6 @@ void socket_init(void);
 void socket_shutdown(void);
 sock_info_t *udpport2sockinfo(uint16_t port);
 sock_info_t *tcpport2sockinfo(uint16_t port);
-#ifdef CONFIG_TCP
-tcp_conn_t *socket_tcp_conn_lookup(const tcp_uid_t *uid);
-#endif
 
 /* user app functions */
 #ifdef CONFIG_BSD_COMPAT
@@ -343,13 +340,16 @@ int socket_get_pkt(int fd, pkt_t **pkt, struct sockaddr_in *addr);
  * @param[in]  fd      file descriptor
  * @param[in]  sbuf    static buffer
  * @param[out] addr    dest sockaddr
- * @return 0 on success, -1 on failure
+ * @return number of bytes sent, -1 on failure
  */
 int
 socket_put_sbuf(int fd, const sbuf_t *sbuf, const struct sockaddr_in *addr);
 #endif
 
 /** Get packet from a network socket
+ *
+ * A UDP datagram reassembled from IP fragments is returned as a packet
+ * chain and has to be freed with pkt_chain_free().
  *
  * @param[in]  sock_info  network socket
  * @param[out] pkt        packet
@@ -366,7 +366,10 @@ int __socket_get_pkt(sock_info_t *sock_info, pkt_t **pkt,
  * @param[in]  sbuf       static buffer
  * @param[in]  dst_addr   dest address
  * @param[in]  dst_port   dest port
- * @return 0 on success, -1 on failure
+ * @return number of bytes sent, less than the buffer length if a TCP
+ *         stream was only partially sent, -1 on failure. A TCP write
+ *         fails with EAGAIN while CONFIG_TCP_SND_QUEUE_MAX segments wait
+ *         for the peer's window.
  */
 int __socket_put_sbuf(sock_info_t *sock_info, const sbuf_t *sbuf,
 		      uint32_t dst_addr, uint16_t dst_port);
@@ -64,6 +64,11 @@ typedef struct __PACKED__ swen_l3_hdr_encr {
 	swen_l3_hdr_t l3_hdr;
 } swen_l3_hdr_encr_t;
 
+/* headers plus room for the xtea padding */
+#define SWEN_L3_CTRL_PKT_SIZE (int)(SWEN_L3_HEADER_RESERVED_LEN	\
+				    + sizeof(swen_hdr_t)		\
+				    + sizeof(swen_l3_hdr_encr_t) + 8)
+
 /* #define SWEN_L3_DEBUG */
 #ifdef SWEN_L3_DEBUG
 #define OP_STR_CASE(op)				\
@@ -105,6 +110,7 @@ pkt_t *swen_l3_get_pkt(swen_l3_assoc_t *assoc)
 
 static int swen_l3_output(uint8_t op, swen_l3_assoc_t *assoc,
 			  const sbuf_t *sbuf);
+static void swen_l3_send_ack_task_cb(void *arg);
 
 static inline uint8_t swen_l3_get_pkt_retries(pkt_t *pkt)
 {
@@ -206,7 +212,7 @@ void swen_l3_retransmit_pkts(swen_l3_assoc_t *assoc)
 
 static void swen_l3_timer_cb(void *arg)
 {
-	schedule_task(swen_l3_task_cb, arg);
+	schedule_task_prio(swen_l3_task_cb, arg, SCHEDULER_PRIO_HIGH);
 }
 
 static int __swen_l3_output(pkt_t *pkt, swen_l3_assoc_t *assoc, uint8_t op,
@@ -303,7 +309,13 @@ swen_l3_output(uint8_t op, swen_l3_assoc_t *assoc, const sbuf_t *sbuf)
 		timer_add(&assoc->timer, SWEN_L3_RETRANSMIT_DELAY * factor,
 			  swen_l3_timer_cb, assoc);
 	}
-	if ((pkt = pkt_alloc()) == NULL) {
+	/* control messages fit into small packets */
+	if (op == S_OP_DATA)
+		pkt = pkt_alloc();
+	else
+		pkt = pkt_alloc_size(SWEN_L3_CTRL_PKT_SIZE
+				     + (sbuf ? sbuf->len : 0));
+	if (pkt == NULL) {
 		if (op == S_OP_DATA)
 			return -1;
 		return 0;
@@ -343,6 +355,7 @@ void swen_l3_assoc_init(swen_l3_assoc_t *assoc, const uint32_t *enc_key)
 	INIT_LIST_HEAD(&assoc->retrn_pkts);
 	INIT_LIST_HEAD(&assoc->incoming_pkts);
 	timer_init(&assoc->timer);
+	sched_task_init(&assoc->ack_task, swen_l3_send_ack_task_cb, assoc);
 }
 
 void swen_l3_assoc_shutdown(swen_l3_assoc_t *assoc)
@@ -350,6 +363,7 @@ void swen_l3_assoc_shutdown(swen_l3_assoc_t *assoc)
 	assoc->state = S_STATE_CLOSED;
 	swen_l3_free_assoc_pkts(assoc);
 	list_del(&assoc->list);
+	scheduler_cancel_task(&assoc->ack_task);
 }
 
 void
@@ -429,8 +443,8 @@ static void swen_l3_send_ack_task_cb(void *arg)
 	if (!assoc->ack_needed)
 		return;
 
-	if ((pkt = pkt_alloc()) == NULL) {
-		schedule_task(swen_l3_send_ack_task_cb, assoc);
+	if ((pkt = pkt_alloc_size(SWEN_L3_CTRL_PKT_SIZE)) == NULL) {
+		schedule_embedded_task(&assoc->ack_task, SCHEDULER_PRIO_HIGH);
 		return;
 	}
 	pkt_adj(pkt, SWEN_L3_HEADER_RESERVED_LEN);
@@ -562,7 +576,7 @@ void swen_l3_input(uint8_t from, pkt_t *pkt, const iface_t *iface)
 #ifdef CONFIG_EVENT
 		event_schedule_event(&assoc->event, EV_READ | EV_WRITE);
 #endif
-		schedule_task(swen_l3_send_ack_task_cb, assoc);
+		schedule_embedded_task(&assoc->ack_task, SCHEDULER_PRIO_HIGH);
 		return;
 
 	case S_OP_DISASSOC:
@@ -56,6 +56,7 @@ typedef struct swen_l3_assoc {
 #endif
 	iface_t *iface;
 	const uint32_t *enc_key;
+	sched_task_t ack_task;
 } swen_l3_assoc_t;
 
 /** Get association state
@@ -31,11 +31,11 @@
 #include "tr-chksum.h"
 #include "socket.h"
 
-#ifdef CONFIG_HT_STORAGE
-static HTABLE_DECL(tcp_conns, CONFIG_MAX_SOCK_HT_SIZE);
-#else
-static list_t tcp_conns = LIST_HEAD_INIT(tcp_conns);
-#endif
+#define TCP_CONN_TABLE_MASK (CONFIG_TCP_CONN_TABLE_SIZE - 1)
+
+/* open addressing (linear probing) table of active and backlogged
+ * connections indexed by their 4-tuple */
+static tcp_conn_t *tcp_conns[CONFIG_TCP_CONN_TABLE_SIZE];
 static uint8_t tcp_conn_cnt;
 
 struct syn_entries {
@@ -51,7 +51,16 @@ list_t tcp_client_conns = LIST_HEAD_INIT(tcp_client_conns);
 #endif
 
 #ifdef CONFIG_TCP_RETRANSMIT
-#define TCP_IN_PROGRESS_RETRIES 3
+#define TCP_IN_PROGRESS_RETRIES 6
+#define TCP_DUP_ACK_THRESHOLD 3
+
+#define TCP_MS_TO_TICKS(ms) ((ms) * 1000UL / CONFIG_TIMER_RESOLUTION_US)
+#if TCP_MS_TO_TICKS(200) > 0
+#define TCP_RTO_MIN TCP_MS_TO_TICKS(200)
+#else
+#define TCP_RTO_MIN 1
+#endif
+#define TCP_RTO_MAX TCP_MS_TO_TICKS(60000)
 #endif
 
 static tcp_syn_t *syn_find_entry(const tcp_uid_t *uid)
@@ -71,6 +80,51 @@ static inline void tcp_retransmit_init(tcp_retrn_t *retrn)
 {
 	timer_init(&retrn->timer);
 	INIT_LIST_HEAD(&retrn->retrn_pkt_list);
+	retrn->cnt = 0;
+	retrn->persist = 0;
+	retrn->dup_acks = 0;
+	retrn->timing = 0;
+	retrn->srtt = 0;
+	retrn->rttvar = 0;
+	retrn->rto = TCP_MS_TO_TICKS(CONFIG_TCP_RETRANSMIT_TIMEOUT);
+}
+
+/* Jacobson/Karels estimator (RFC 6298), srtt is scaled by 8 and
+ * rttvar by 4 */
+static void tcp_rtt_update(tcp_retrn_t *retrn, uint32_t rtt)
+{
+	int32_t delta;
+	uint32_t rto;
+
+	if (retrn->srtt == 0) {
+		retrn->srtt = rtt << 3;
+		retrn->rttvar = rtt << 1;
+	} else {
+		delta = rtt - (retrn->srtt >> 3);
+		retrn->srtt += delta;
+		if (delta < 0)
+			delta = -delta;
+		retrn->rttvar += delta - (retrn->rttvar >> 2);
+	}
+	if (retrn->srtt == 0)
+		retrn->srtt = 1;
+
+	rto = (retrn->srtt >> 3) + MAX(retrn->rttvar, 1);
+	if (rto < TCP_RTO_MIN)
+		rto = TCP_RTO_MIN;
+	else if (rto > TCP_RTO_MAX)
+		rto = TCP_RTO_MAX;
+	retrn->rto = rto;
+}
+
+uint32_t tcp_conn_get_rtt(const tcp_conn_t *tcp_conn)
+{
+	return (tcp_conn->retrn.srtt >> 3) * CONFIG_TIMER_RESOLUTION_US;
+}
+
+uint32_t tcp_conn_get_rto(const tcp_conn_t *tcp_conn)
+{
+	return tcp_conn->retrn.rto * CONFIG_TIMER_RESOLUTION_US;
 }
 
 static void tcp_retrn_wipe(tcp_conn_t *tcp_conn)
@@ -87,6 +141,116 @@ static void tcp_retrn_wipe(tcp_conn_t *tcp_conn)
 }
 #endif
 
+static void tcp_snd_queue_wipe(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	list_for_each_entry_safe(pkt, pkt_tmp, &tcp_conn->snd.queue, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	tcp_conn->snd.queued = 0;
+}
+
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+/* out of order segments are stored from their ip header and truncated
+ * to the ip packet length */
+static uint32_t tcp_ooo_seqid(const pkt_t *pkt)
+{
+	const ip_hdr_t *ip_hdr = btod(pkt);
+	const tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr +
+						 ip_hdr->hl * 4);
+
+	return ntohl(tcp_hdr->seq);
+}
+
+static int tcp_ooo_len(const pkt_t *pkt)
+{
+	const ip_hdr_t *ip_hdr = btod(pkt);
+	const tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)((uint8_t *)ip_hdr +
+						 ip_hdr->hl * 4);
+
+	return pkt_len(pkt) - ip_hdr->hl * 4 - tcp_hdr->hdr_len * 4;
+}
+
+static void tcp_ooo_enqueue(tcp_conn_t *tcp_conn, pkt_t *pkt, uint32_t seqid)
+{
+	list_t *pos = &tcp_conn->ooo_list;
+	pkt_t *p;
+
+	if (tcp_conn->ooo_cnt >= CONFIG_TCP_OOO_MAX_PKTS)
+		goto drop;
+
+	/* keep the queue sorted by sequence number */
+	list_for_each_entry(p, &tcp_conn->ooo_list, list) {
+		uint32_t p_seqid = tcp_ooo_seqid(p);
+
+		if (p_seqid == seqid)
+			goto drop;
+		if (SEQ_GT(p_seqid, seqid)) {
+			pos = &p->list;
+			break;
+		}
+	}
+	list_add_tail(&pkt->list, pos);
+	tcp_conn->ooo_cnt++;
+	return;
+ drop:
+	pkt_free(pkt);
+}
+
+/* move the segments following ack to the receive queue */
+static uint32_t tcp_ooo_splice(tcp_conn_t *tcp_conn, uint32_t ack)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	list_for_each_entry_safe(pkt, pkt_tmp, &tcp_conn->ooo_list, list) {
+		uint32_t seqid = tcp_ooo_seqid(pkt);
+
+		if (SEQ_GT(seqid, ack))
+			break;
+		list_del(&pkt->list);
+		tcp_conn->ooo_cnt--;
+		if (seqid != ack) {
+			/* duplicate or overlapping data, the peer will
+			 * retransmit what is missing */
+			pkt_free(pkt);
+			continue;
+		}
+		ack += tcp_ooo_len(pkt);
+		socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
+	}
+	return ack;
+}
+
+static void tcp_ooo_wipe(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	list_for_each_entry_safe(pkt, pkt_tmp, &tcp_conn->ooo_list, list) {
+		list_del(&pkt->list);
+		pkt_free(pkt);
+	}
+	tcp_conn->ooo_cnt = 0;
+}
+#endif
+
+/* control segments carry no payload, only the MSS option */
+#define TCP_CTRL_PKT_SIZE (int)(sizeof(eth_hdr_t) + sizeof(ip_hdr_t) \
+				+ sizeof(tcp_hdr_t) + TCPOLEN_MAXSEG)
+
+#define TCP_PKT_MSS (int)(CONFIG_PKT_SIZE - sizeof(eth_hdr_t)		\
+			  - sizeof(ip_hdr_t) - sizeof(tcp_hdr_t)	\
+			  - TCPOLEN_MAXSEG)
+#ifdef CONFIG_IP_FRAG
+/* segments are sent with IP_DF */
+#define TCP_LOCAL_MSS MIN(TCP_PKT_MSS, (int)(CONFIG_IP_MTU		\
+					     - sizeof(ip_hdr_t)		\
+					     - sizeof(tcp_hdr_t)))
+#else
+#define TCP_LOCAL_MSS TCP_PKT_MSS
+#endif
+
 static void __tcp_adj_out_pkt(pkt_t *out)
 {
 	pkt_adj(out, (int)sizeof(eth_hdr_t) + (int)sizeof(ip_hdr_t)
@@ -98,8 +262,8 @@ static void tcp_close(tcp_conn_t *tcp_conn, pkt_t *fin_pkt)
 {
 	tcp_conn->syn.status = SOCK_TCP_FIN_SENT;
 	__tcp_adj_out_pkt(fin_pkt);
-	tcp_output(fin_pkt, tcp_conn, TH_FIN|TH_ACK);
-	tcp_conn->syn.seqid = htonl(ntohl(tcp_conn->syn.seqid) + 1);
+	/* the FIN goes out after the queued data */
+	tcp_send(tcp_conn, fin_pkt);
 }
 
 void __tcp_conn_delete(tcp_conn_t *tcp_conn)
@@ -113,15 +277,19 @@ void __tcp_conn_delete(tcp_conn_t *tcp_conn)
 		list_del(&pkt->list);
 		pkt_free(pkt);
 	}
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+	tcp_ooo_wipe(tcp_conn);
+#endif
 
 	if (tcp_conn->syn.status == SOCK_CONNECTED) {
-		pkt_t *fin_pkt = pkt_alloc();
+		pkt_t *fin_pkt = pkt_alloc_size(TCP_CTRL_PKT_SIZE);
 
 		if (fin_pkt != NULL) {
 			tcp_close(tcp_conn, fin_pkt);
 			return;
 		}
 	}
+	tcp_snd_queue_wipe(tcp_conn);
 #ifdef CONFIG_TCP_RETRANSMIT
 	tcp_retrn_wipe(tcp_conn);
 #endif
@@ -130,6 +298,7 @@ void __tcp_conn_delete(tcp_conn_t *tcp_conn)
 	/* make sure tcp_conn is removed from the connection list */
 	if (!list_empty(&tcp_conn->list) && tcp_conn->list.next != LIST_POISON1)
 		list_del(&tcp_conn->list);
+	tcp_conn_unlink(tcp_conn);
 	free(tcp_conn);
 	tcp_conn_cnt--;
 }
@@ -149,6 +318,14 @@ tcp_conn_create(const tcp_uid_t *tuid, uint8_t status, sock_info_t *sock_info)
 	tcp_conn_cnt++;
 	INIT_LIST_HEAD(&conn->pkt_list_head);
 	INIT_LIST_HEAD(&conn->list);
+	INIT_LIST_HEAD(&conn->snd.queue);
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+	INIT_LIST_HEAD(&conn->ooo_list);
+	conn->ooo_cnt = 0;
+#endif
+	conn->snd.una = 0;
+	conn->snd.wnd = 0;
+	conn->snd.queued = 0;
 	conn->syn.status = status;
 	conn->syn.tuid = *tuid;
 	conn->sock_info = sock_info;
@@ -159,62 +336,92 @@ tcp_conn_create(const tcp_uid_t *tuid, uint8_t status, sock_info_t *sock_info)
 	return conn;
 }
 
-#ifdef CONFIG_HT_STORAGE
-int tcp_conn_add(tcp_conn_t *tcp_conn)
+static uint16_t tcp_conn_hash(const tcp_uid_t *uid)
 {
-	sbuf_t key, val;
+	uint32_t h = uid->src_addr ^ uid->dst_addr ^ uid->src_port
+		^ ((uint32_t)uid->dst_port << 16);
 
-	sbuf_init(&key, &tcp_conn->syn.tuid, sizeof(tcp_uid_t));
-	sbuf_init(&val, &tcp_conn, sizeof(tcp_conn_t *));
-	if (htable_add(&tcp_conns, &key, &val) < 0)
-		return -1;
-	return 0;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & TCP_CONN_TABLE_MASK;
 }
 
-void tcp_conn_delete(tcp_conn_t *tcp_conn)
+static int tcp_conn_slot(const tcp_uid_t *uid)
 {
-	sbuf_t key;
+	uint16_t i = tcp_conn_hash(uid);
+	uint16_t n;
 
-	sbuf_init(&key, &tcp_conn->syn.tuid, sizeof(tcp_uid_t));
-	htable_del(&tcp_conns, &key);
-	__tcp_conn_delete(tcp_conn);
+	for (n = 0; n < CONFIG_TCP_CONN_TABLE_SIZE; n++) {
+		tcp_conn_t *tcp_conn = tcp_conns[i];
+
+		if (tcp_conn == NULL)
+			return -1;
+		/* tcp_conn must be packed */
+		if (memcmp(uid, &tcp_conn->syn.tuid, sizeof(tcp_uid_t)) == 0)
+			return i;
+		i = (i + 1) & TCP_CONN_TABLE_MASK;
+	}
+	return -1;
 }
 
-tcp_conn_t *tcp_conn_lookup(const tcp_uid_t *uid)
+int tcp_conn_add(tcp_conn_t *tcp_conn)
 {
-	sbuf_t key, *val;
+	uint16_t i = tcp_conn_hash(&tcp_conn->syn.tuid);
+	uint16_t n;
+
+	STATIC_ASSERT(POWEROF2(CONFIG_TCP_CONN_TABLE_SIZE));
+	STATIC_ASSERT(CONFIG_TCP_CONN_TABLE_SIZE > CONFIG_TCP_MAX_CONNS);
 
-	sbuf_init(&key, uid, sizeof(tcp_uid_t));
-	if (htable_lookup(&tcp_conns, &key, &val) < 0)
-		return socket_tcp_conn_lookup(uid);
-	return *(tcp_conn_t **)val->data;
+	for (n = 0; n < CONFIG_TCP_CONN_TABLE_SIZE; n++) {
+		if (tcp_conns[i] == NULL) {
+			tcp_conns[i] = tcp_conn;
+			return 0;
+		}
+		if (tcp_conns[i] == tcp_conn)
+			return 0;
+		i = (i + 1) & TCP_CONN_TABLE_MASK;
+	}
+	return -1;
 }
-#else /* CONFIG_HT_STORAGE */
 
-int tcp_conn_add(tcp_conn_t *tcp_conn)
+void tcp_conn_unlink(tcp_conn_t *tcp_conn)
 {
-	list_add_tail(&tcp_conn->list, &tcp_conns);
-	return 0;
+	int slot = tcp_conn_slot(&tcp_conn->syn.tuid);
+	uint16_t i, j, k;
+
+	if (slot < 0 || tcp_conns[slot] != tcp_conn)
+		return;
+
+	/* backward shift deletion, no tombstones */
+	i = j = slot;
+	for (;;) {
+		j = (j + 1) & TCP_CONN_TABLE_MASK;
+		if (tcp_conns[j] == NULL)
+			break;
+		k = tcp_conn_hash(&tcp_conns[j]->syn.tuid);
+		/* move the entry unless its home slot lies in ]i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		tcp_conns[i] = tcp_conns[j];
+		i = j;
+	}
+	tcp_conns[i] = NULL;
 }
 
 void tcp_conn_delete(tcp_conn_t *tcp_conn)
 {
-	list_del(&tcp_conn->list);
+	tcp_conn_unlink(tcp_conn);
 	__tcp_conn_delete(tcp_conn);
 }
 
 tcp_conn_t *tcp_conn_lookup(const tcp_uid_t *uid)
 {
-	tcp_conn_t *tcp_conn;
-	list_for_each_entry(tcp_conn, &tcp_conns, list) {
-		/* tcp_conn must be packed */
-		if (memcmp(uid, &tcp_conn->syn.tuid, sizeof(tcp_uid_t)) == 0)
-			return tcp_conn;
-	}
-	return socket_tcp_conn_lookup(uid);
-}
+	int slot = tcp_conn_slot(uid);
 
-#endif
+	if (slot < 0)
+		return NULL;
+	return tcp_conns[slot];
+}
 
 #ifdef CONFIG_TCP_CLIENT
 static tcp_conn_t *tcp_client_conn_lookup(const tcp_uid_t *uid)
@@ -229,6 +436,15 @@ static tcp_conn_t *tcp_client_conn_lookup(const tcp_uid_t *uid)
 }
 #endif
 
+int tcp_conn_get_mss(const tcp_conn_t *tcp_conn)
+{
+	uint16_t mss = tcp_conn->syn.opts.mss;
+
+	if (mss == 0 || mss > TCP_LOCAL_MSS)
+		return TCP_LOCAL_MSS;
+	return mss;
+}
+
 static int tcp_set_options(void *data, const tcp_options_t *tcp_opts)
 {
 	uint8_t *opts = data;
@@ -239,8 +455,7 @@ static int tcp_set_options(void *data, const tcp_options_t *tcp_opts)
 	opts[0] = TCPOPT_MAXSEG;
 	opts[1] = TCPOLEN_MAXSEG;
 	opts += 2;
-	mss = CONFIG_PKT_SIZE - sizeof(eth_hdr_t)
-		- sizeof(ip_hdr_t) - sizeof(tcp_hdr_t) - TCPOLEN_MAXSEG;
+	mss = TCP_LOCAL_MSS;
 	*(uint16_t *)opts = htons(mss);
 	opts_len += TCPOLEN_MAXSEG;
 	return opts_len;
@@ -259,33 +474,64 @@ static void tcp_conn_delete_task(void *tcp_conn)
 }
 
 static void tcp_retransmit(void *tcp_conn);
-static inline void tcp_arm_retrn_timer(tcp_conn_t *tcp_conn, pkt_t *pkt)
+static int __tcp_send(tcp_conn_t *tcp_conn, pkt_t *pkt);
+
+/* retransmission timeout in microseconds with exponential backoff */
+static uint32_t tcp_retrn_timeout(const tcp_conn_t *tcp_conn)
 {
+	uint8_t shift = tcp_conn->retrn.cnt + tcp_conn->retrn.persist;
+	uint32_t rto = tcp_conn->retrn.rto;
+
+	if (rto > TCP_RTO_MAX >> shift)
+		rto = TCP_RTO_MAX;
+	else
+		rto <<= shift;
+	return rto * CONFIG_TIMER_RESOLUTION_US;
+}
+
+static void tcp_retransmit_pkt(pkt_t *pkt)
+{
+	pkt_retain(pkt);
+	/* adjust the pkt to ip header */
+	__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t));
+	ip_output(pkt, NULL, IP_DF);
+}
+
+/* returns 1 if the pkt has been queued for retransmission */
+static inline int tcp_arm_retrn_timer(tcp_conn_t *tcp_conn, pkt_t *pkt)
+{
+	int queued = 0;
+
 	if (pkt) {
 		tcp_retrn_pkt_t *retrn_pkt;
 
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 		/* no retransmission for emergency packets */
 		if (pkt_is_emergency(pkt))
-			return;
+			return 0;
 #endif
 		/* XXX TODO: check if there is room at the begining or
 		 * the end of the packet to avoid this malloc. */
 		if ((retrn_pkt = malloc(sizeof(tcp_retrn_pkt_t))) == NULL)
-			return;
-		tcp_conn->retrn.cnt = 0;
+			return 0;
+		if (!tcp_conn->retrn.timing) {
+			/* time one segment per round trip */
+			tcp_conn->retrn.timing = 1;
+			tcp_conn->retrn.rtt_seqid = ntohl(tcp_conn->syn.seqid);
+			tcp_conn->retrn.rtt_ticks = timer_ticks;
+		}
 		INIT_LIST_HEAD(&retrn_pkt->list);
 		retrn_pkt->pkt = pkt;
 		pkt_retain(pkt);
 		list_add_tail(&retrn_pkt->list,
 			      &tcp_conn->retrn.retrn_pkt_list);
+		queued = 1;
 	}
 
-	if (timer_is_pending(&tcp_conn->retrn.timer))
-		return;
-
-	timer_add(&tcp_conn->retrn.timer, CONFIG_TCP_RETRANSMIT_TIMEOUT * 1000UL
-		  * (tcp_conn->retrn.cnt + 1), tcp_retransmit, tcp_conn);
+	if (!timer_is_pending(&tcp_conn->retrn.timer))
+		timer_add(&tcp_conn->retrn.timer, tcp_retrn_timeout(tcp_conn),
+			  tcp_retransmit, tcp_conn);
+	return queued;
 }
 
 static void tcp_delayed_close(void *arg)
@@ -305,6 +551,10 @@ static void tcp_conn_mark_closed(tcp_conn_t *tcp_conn, uint8_t error)
 {
 	tcp_conn->syn.status = SOCK_CLOSED;
 	tcp_conn->sock_info->trq.tcp_conn = NULL;
+	tcp_snd_queue_wipe(tcp_conn);
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+	tcp_ooo_wipe(tcp_conn);
+#endif
 	tcp_retrn_wipe(tcp_conn);
 	timer_add(&tcp_conn->retrn.timer,
 		  CONFIG_TCP_RETRANSMIT_TIMEOUT * 1000UL,
@@ -318,7 +568,6 @@ static void tcp_conn_mark_closed(tcp_conn_t *tcp_conn, uint8_t error)
 
 static void tcp_retransmit(void *arg)
 {
-	tcp_retrn_pkt_t *retrn_pkt;
 	tcp_conn_t *tcp_conn = arg;
 
 	if (tcp_conn->retrn.cnt >= TCP_IN_PROGRESS_RETRIES) {
@@ -330,17 +579,32 @@ static void tcp_retransmit(void *arg)
 		return;
 	}
 
-	list_for_each_entry(retrn_pkt, &tcp_conn->retrn.retrn_pkt_list, list) {
-		pkt_t *pkt = retrn_pkt->pkt;
+	/* Karn's algorithm: don't time retransmitted segments */
+	tcp_conn->retrn.timing = 0;
+	tcp_conn->retrn.cnt++;
+	/* The peer's window is closed, back off the window probes on
+	 * their own: an answered probe resets the retry count. */
+	if (tcp_conn->snd.wnd == 0
+	    && tcp_conn->retrn.persist < TCP_IN_PROGRESS_RETRIES)
+		tcp_conn->retrn.persist++;
+	if (!list_empty(&tcp_conn->retrn.retrn_pkt_list)) {
+		tcp_retrn_pkt_t *retrn_pkt;
 
-		pkt_retain(pkt);
-		/* adjust the pkt to ip header */
-		__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t));
+		/* resend the first unacknowledged segment only */
+		retrn_pkt = list_first_entry(&tcp_conn->retrn.retrn_pkt_list,
+					     tcp_retrn_pkt_t, list);
+		tcp_retransmit_pkt(retrn_pkt->pkt);
+	} else if (!list_empty(&tcp_conn->snd.queue)) {
+		pkt_t *pkt = list_first_entry(&tcp_conn->snd.queue, pkt_t,
+					      list);
 
-		ip_output(pkt, NULL, IP_DF);
+		/* the peer's window is closed, probe it with the first
+		 * queued segment */
+		list_del(&pkt->list);
+		tcp_conn->snd.queued--;
+		__tcp_send(tcp_conn, pkt);
+		return;
 	}
-
-	tcp_conn->retrn.cnt++;
 	tcp_arm_retrn_timer(tcp_conn, NULL);
 }
 #endif
@@ -364,7 +628,9 @@ __tcp_output(pkt_t *pkt, uint32_t ip_dst, uint8_t ctrl, uint16_t sport,
 	tcp_hdr->ack = tcp_syn->ack;
 	tcp_hdr->reserved = 0;
 	tcp_hdr->ctrl = ctrl;
-	tcp_hdr->win_size = (ctrl & TH_RST) ? 0 : htons(pkt->buf.size * 2);
+	/* the window is based on the receive packets, control segments
+	 * may come from a smaller size class */
+	tcp_hdr->win_size = (ctrl & TH_RST) ? 0 : htons(CONFIG_PKT_SIZE * 2);
 	tcp_hdr->urg_ptr = 0;
 	if (ctrl & TH_SYN) {
 		int opts_len = tcp_set_options(tcp_hdr + 1, &tcp_syn->opts);
@@ -379,13 +645,92 @@ __tcp_output(pkt_t *pkt, uint32_t ip_dst, uint8_t ctrl, uint16_t sport,
 
 int tcp_output(pkt_t *pkt, tcp_conn_t *tcp_conn, uint8_t flags)
 {
+	int ret;
 #ifdef CONFIG_TCP_RETRANSMIT
-	tcp_arm_retrn_timer(tcp_conn, pkt);
+	int queued = tcp_arm_retrn_timer(tcp_conn, pkt);
 #endif
 	/* XXX */
-	return __tcp_output(pkt, tcp_conn->syn.tuid.src_addr, flags,
-			    tcp_conn->syn.tuid.dst_port,
-			    tcp_conn->syn.tuid.src_port, &tcp_conn->syn);
+	ret = __tcp_output(pkt, tcp_conn->syn.tuid.src_addr, flags,
+			   tcp_conn->syn.tuid.dst_port,
+			   tcp_conn->syn.tuid.src_port, &tcp_conn->syn);
+#ifdef CONFIG_TCP_RETRANSMIT
+	/* the segment will be delivered by the retransmission timer */
+	if (queued)
+		return 0;
+#endif
+	return ret;
+}
+
+static inline int tcp_snd_payload_len(const pkt_t *pkt)
+{
+	return pkt_len(pkt) - (int)sizeof(tcp_hdr_t);
+}
+
+static int tcp_snd_wnd_fits(const tcp_conn_t *tcp_conn, const pkt_t *pkt)
+{
+	uint32_t in_flight = ntohl(tcp_conn->syn.seqid) - tcp_conn->snd.una;
+	int len = tcp_snd_payload_len(pkt);
+
+	if (len == 0)
+		return 1;
+	/* let a segment larger than a small (but open) window go out
+	 * if nothing is in flight */
+	if (in_flight == 0)
+		return tcp_conn->snd.wnd != 0;
+	return in_flight + len <= tcp_conn->snd.wnd;
+}
+
+static int __tcp_send(tcp_conn_t *tcp_conn, pkt_t *pkt)
+{
+	int len = tcp_snd_payload_len(pkt);
+	uint8_t flags = len ? TH_PUSH|TH_ACK : TH_FIN|TH_ACK;
+
+	/* the segment is lost, its sequence space is reused */
+	if (tcp_output(pkt, tcp_conn, flags) < 0)
+		return -1;
+
+	/* a FIN consumes one sequence number */
+	tcp_conn->syn.seqid = htonl(ntohl(tcp_conn->syn.seqid) +
+				    (len ? len : 1));
+	return 0;
+}
+
+static void tcp_snd_queue_flush(tcp_conn_t *tcp_conn)
+{
+	pkt_t *pkt, *pkt_tmp;
+
+	list_for_each_entry_safe(pkt, pkt_tmp, &tcp_conn->snd.queue, list) {
+		if (!tcp_snd_wnd_fits(tcp_conn, pkt))
+			break;
+		list_del(&pkt->list);
+		tcp_conn->snd.queued--;
+		__tcp_send(tcp_conn, pkt);
+	}
+#ifdef CONFIG_TCP_RETRANSMIT
+	/* persist timer */
+	if (!list_empty(&tcp_conn->snd.queue))
+		tcp_arm_retrn_timer(tcp_conn, NULL);
+#endif
+}
+
+int tcp_send(tcp_conn_t *tcp_conn, pkt_t *pkt)
+{
+	if (list_empty(&tcp_conn->snd.queue)
+	    && tcp_snd_wnd_fits(tcp_conn, pkt))
+		return __tcp_send(tcp_conn, pkt);
+
+	/* the FIN is always queued, it is the last segment */
+	if (tcp_snd_payload_len(pkt) && tcp_snd_queue_is_full(tcp_conn)) {
+		pkt_free(pkt);
+		return -1;
+	}
+	list_add_tail(&pkt->list, &tcp_conn->snd.queue);
+	tcp_conn->snd.queued++;
+#ifdef CONFIG_TCP_RETRANSMIT
+	/* persist timer */
+	tcp_arm_retrn_timer(tcp_conn, NULL);
+#endif
+	return 0;
 }
 
 static int
@@ -394,7 +739,7 @@ tcp_send_pkt(const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr, uint8_t flags,
 {
 	pkt_t *out;
 
-	if ((out = pkt_alloc()) == NULL
+	if ((out = pkt_alloc_size(TCP_CTRL_PKT_SIZE)) == NULL
 #ifdef CONFIG_PKT_MEM_POOL_EMERGENCY_PKT
 	    && (out = pkt_alloc_emergency()) == NULL
 #endif
@@ -410,34 +755,66 @@ tcp_send_pkt(const ip_hdr_t *ip_hdr, const tcp_hdr_t *tcp_hdr, uint8_t flags,
 static void tcp_retrn_ack_pkts(tcp_conn_t *tcp_conn, uint32_t remote_ack)
 {
 	tcp_retrn_pkt_t *retrn_pkt, *retrn_pkt_tmp;
+	uint8_t acked = 0;
+
+	if (tcp_conn->retrn.timing
+	    && SEQ_GT(remote_ack, tcp_conn->retrn.rtt_seqid)) {
+		tcp_rtt_update(&tcp_conn->retrn,
+			       timer_ticks - tcp_conn->retrn.rtt_ticks);
+		tcp_conn->retrn.timing = 0;
+	}
 
 	list_for_each_entry_safe(retrn_pkt, retrn_pkt_tmp,
 				 &tcp_conn->retrn.retrn_pkt_list, list) {
 		pkt_t *pkt = retrn_pkt->pkt;
+		ip_hdr_t *ip_hdr;
 		tcp_hdr_t *tcp_hdr;
 		int payload_len;
 		uint32_t seqid;
 
-		/* get tcp payload size */
-		__tcp_pkt_adj_reset(pkt, (int)sizeof(eth_hdr_t) +
-				    (int)sizeof(ip_hdr_t));
-		tcp_hdr = btod(pkt);
+		/* get tcp payload size. The pkt may still be queued for
+		 * transmission (fast retransmit), don't adjust it. */
+		ip_hdr = (ip_hdr_t *)(pkt->buf.data - pkt->buf.skip +
+				      sizeof(eth_hdr_t));
+		tcp_hdr = (tcp_hdr_t *)(ip_hdr + 1);
 		seqid = ntohl(tcp_hdr->seq);
-		payload_len = pkt->buf.len - tcp_hdr->hdr_len * 4;
+		payload_len = ntohs(ip_hdr->len) - sizeof(ip_hdr_t)
+			- tcp_hdr->hdr_len * 4;
 
-		if (seqid + payload_len <= remote_ack) {
+		if (SEQ_LEQ(seqid + payload_len, remote_ack)) {
 			pkt_free(retrn_pkt->pkt);
 			list_del(&retrn_pkt->list);
 			free(retrn_pkt);
+			acked = 1;
 		}
 #if 0
 		else if (seqid >= remote_ack)
 			break;
 #endif
 	}
-	if (list_empty(&tcp_conn->retrn.retrn_pkt_list) &&
-	    tcp_conn->retrn.timer.cb != tcp_delayed_close)
-		timer_del(&tcp_conn->retrn.timer);
+	if (tcp_conn->retrn.timer.cb == tcp_delayed_close || !acked)
+		return;
+
+	tcp_conn->retrn.cnt = 0;
+	tcp_conn->retrn.dup_acks = 0;
+	timer_del(&tcp_conn->retrn.timer);
+	if (!list_empty(&tcp_conn->retrn.retrn_pkt_list))
+		tcp_arm_retrn_timer(tcp_conn, NULL);
+}
+
+static void tcp_retrn_dup_ack(tcp_conn_t *tcp_conn)
+{
+	tcp_retrn_pkt_t *retrn_pkt;
+
+	if (list_empty(&tcp_conn->retrn.retrn_pkt_list)
+	    || ++tcp_conn->retrn.dup_acks != TCP_DUP_ACK_THRESHOLD)
+		return;
+
+	/* fast retransmit */
+	retrn_pkt = list_first_entry(&tcp_conn->retrn.retrn_pkt_list,
+				     tcp_retrn_pkt_t, list);
+	tcp_conn->retrn.timing = 0;
+	tcp_retransmit_pkt(retrn_pkt->pkt);
 }
 #endif
 
@@ -508,7 +885,7 @@ int tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *si)
 	if (tcp_conn == NULL)
 		return -1;
 
-	if ((pkt = pkt_alloc()) == NULL) {
+	if ((pkt = pkt_alloc_size(TCP_CTRL_PKT_SIZE)) == NULL) {
 		free(tcp_conn);
 		return -1;
 	}
@@ -523,12 +900,12 @@ int tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *si)
 }
 #endif
 
-void tcp_input(pkt_t *pkt)
+void tcp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info)
 {
 	tcp_hdr_t *tcp_hdr;
-	ip_hdr_t *ip_hdr = btod(pkt);
-	uint16_t ip_hdr_len = ip_hdr->hl * 4;
-	uint16_t ip_plen = ntohs(ip_hdr->len) - ip_hdr_len;
+	ip_hdr_t *ip_hdr = info->hdr;
+	uint16_t ip_hdr_len = info->hdr_len;
+	uint16_t ip_plen = info->plen;
 	uint16_t tcp_hdr_len;
 	sock_info_t *sock_info = NULL;
 	tcp_uid_t tuid;
@@ -542,6 +919,14 @@ void tcp_input(pkt_t *pkt)
 
 	STATIC_ASSERT(POWEROF2(CONFIG_TCP_SYN_TABLE_SIZE));
 
+	(void)iface;
+#ifdef CONFIG_IP_FRAG
+	/* a segment is not larger than the MSS */
+	if (pkt->next && pkt_chain_linearize(pkt) < 0) {
+		pkt_chain_free(pkt);
+		return;
+	}
+#endif
 	pkt_adj(pkt, ip_hdr_len);
 	tcp_hdr = btod(pkt);
 	if (tcp_hdr->hdr_len < 4 || tcp_hdr->hdr_len > 15)
@@ -561,8 +946,10 @@ void tcp_input(pkt_t *pkt)
 	};
 
 	if ((tcp_conn = tcp_conn_lookup(&tuid)) != NULL) {
-		int flags = 0, plen;
+		pkt_t *fin_pkt = NULL;
+		uint8_t fin = 0;
 		uint32_t ack, seqid;
+		int plen;
 
 		if (tcp_hdr->ctrl & TH_RST) {
 			if (tcp_conn->syn.status != SOCK_CLOSED) {
@@ -581,26 +968,54 @@ void tcp_input(pkt_t *pkt)
 			tcp_send_pkt(ip_hdr, tcp_hdr, TH_ACK, &tcp_conn->syn);
 			goto end;
 		}
-		if (remote_seqid > ack)
+		if (SEQ_GT(remote_seqid, ack)) {
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+			if (pkt->buf.len >= ip_plen && ip_plen > tcp_hdr_len
+			    && (tcp_hdr->ctrl & (TH_SYN|TH_FIN)) == 0) {
+				/* ack what we have got so far */
+				tcp_send_pkt(ip_hdr, tcp_hdr, TH_ACK,
+					     &tcp_conn->syn);
+				pkt->buf.len = ip_plen;
+				pkt_adj(pkt, -ip_hdr_len);
+				tcp_ooo_enqueue(tcp_conn, pkt, remote_seqid);
+				return;
+			}
+#endif
 			goto end;
+		}
 
 		if ((tcp_hdr->ctrl & TH_ACK)) {
-			if (remote_ack > seqid) {
+			uint16_t wnd = ntohs(tcp_hdr->win_size);
+
+			if (SEQ_GT(remote_ack, seqid)) {
 				/* drop the packet */
 				goto end;
 			}
 #ifdef CONFIG_TCP_RETRANSMIT
+			if (remote_ack == tcp_conn->snd.una
+			    && ip_plen == tcp_hdr_len
+			    && wnd == tcp_conn->snd.wnd && wnd
+			    && (tcp_hdr->ctrl & (TH_SYN|TH_FIN)) == 0)
+				tcp_retrn_dup_ack(tcp_conn);
+#endif
+			if (SEQ_GT(remote_ack, tcp_conn->snd.una))
+				tcp_conn->snd.una = remote_ack;
+			tcp_conn->snd.wnd = wnd;
+#ifdef CONFIG_TCP_RETRANSMIT
+			/* the peer is alive, keep probing its closed window */
+			if (wnd == 0)
+				tcp_conn->retrn.cnt = 0;
+			else
+				tcp_conn->retrn.persist = 0;
 			tcp_retrn_ack_pkts(tcp_conn, remote_ack);
 #endif
 		}
 		if (tcp_hdr->ctrl & TH_FIN) {
 			ack++;
-			if (tcp_conn->syn.status == SOCK_CONNECTED) {
-				flags |= TH_FIN|TH_ACK;
-				tcp_conn->syn.status = SOCK_TCP_FIN_SENT;
-			}
+			fin = tcp_conn->syn.status == SOCK_CONNECTED;
 		} else if (tcp_hdr->ctrl == TH_ACK
 			   && tcp_conn->syn.status == SOCK_TCP_FIN_SENT
+			   && list_empty(&tcp_conn->snd.queue)
 			   && tcp_hdr->ack == tcp_conn->syn.seqid) {
 #ifdef CONFIG_TCP_RETRANSMIT
 				tcp_conn_mark_closed(tcp_conn, 0);
@@ -615,33 +1030,48 @@ void tcp_input(pkt_t *pkt)
 		plen = ip_plen - tcp_hdr_len;
 		if (pkt->buf.len > plen)
 			pkt->buf.len = plen;
-
-		ack += pkt->buf.len;
+		plen = pkt->buf.len;
+
+		ack += plen;
+		if (plen) {
+			pkt_adj(pkt, -(tcp_hdr_len + ip_hdr_len));
+			socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+			/* the segment may have filled a gap */
+			if (!list_empty(&tcp_conn->ooo_list))
+				ack = tcp_ooo_splice(tcp_conn, ack);
+#endif
+		}
 		tcp_conn->syn.ack = htonl(ack);
-		if (remote_seqid < ack)
-			tcp_send_pkt(ip_hdr, tcp_hdr, flags | TH_ACK,
-				     &tcp_conn->syn);
+		if (fin)
+			fin_pkt = pkt_alloc_size(TCP_CTRL_PKT_SIZE);
+		/* a FIN sent right away acks the peer's one */
+		if (remote_seqid < ack
+		    && (fin_pkt == NULL || !list_empty(&tcp_conn->snd.queue)))
+			tcp_send_pkt(ip_hdr, tcp_hdr, TH_ACK, &tcp_conn->syn);
+		tcp_snd_queue_flush(tcp_conn);
 #ifdef CONFIG_EVENT
-		if (pkt->buf.len)
+		if (plen)
 			event_schedule_event(&tcp_conn->sock_info->event,
 					     EV_READ);
 #endif
 
-		if (flags & TH_FIN) {
-			seqid++;
-			tcp_conn->syn.seqid = htonl(seqid);
+		if (fin) {
+			/* our FIN goes out after the queued data, the
+			 * connection is closed once it is acked */
+			if (fin_pkt)
+				tcp_close(tcp_conn, fin_pkt);
+			else {
 #ifdef CONFIG_TCP_RETRANSMIT
-			tcp_conn_mark_closed(tcp_conn, 0);
+				tcp_conn_mark_closed(tcp_conn, 1);
 #else
-			tcp_conn_delete(tcp_conn);
+				tcp_conn_delete(tcp_conn);
 #endif
+			}
 		}
 
-		if (pkt->buf.len == 0)
+		if (plen == 0)
 			goto end;
-
-		pkt_adj(pkt, -(tcp_hdr_len + ip_hdr_len));
-		socket_append_pkt(&tcp_conn->pkt_list_head, pkt);
 		return;
 	}
 
@@ -678,6 +1108,8 @@ void tcp_input(pkt_t *pkt)
 				  tcp_hdr_len - sizeof(tcp_hdr_t));
 		seqid = ntohl(tcp_conn->syn.seqid) + 1;
 		tcp_conn->syn.seqid = htonl(seqid);
+		tcp_conn->snd.una = seqid;
+		tcp_conn->snd.wnd = ntohs(tcp_hdr->win_size);
 		tcp_send_pkt(ip_hdr, tcp_hdr, TH_ACK, &tcp_conn->syn);
 		list_del(&tcp_conn->list);
 #ifdef CONFIG_TCP_RETRANSMIT
@@ -757,10 +1189,17 @@ void tcp_input(pkt_t *pkt)
 			tcp_send_pkt(ip_hdr, tcp_hdr, TH_RST, &ts);
 			goto end;
 		}
+		if (tcp_conn_add(tcp_conn) < 0) {
+			__tcp_conn_delete(tcp_conn);
+			tcp_send_pkt(ip_hdr, tcp_hdr, TH_RST, &ts);
+			goto end;
+		}
 		socket_add_backlog(l, tcp_conn);
 		tcp_conn->syn.seqid = tsyn_entry->seqid;
 		tcp_conn->syn.ack = tcp_hdr->seq;
 		tcp_conn->syn.opts = tsyn_entry->opts;
+		tcp_conn->snd.una = ntohl(tsyn_entry->seqid);
+		tcp_conn->snd.wnd = ntohs(tcp_hdr->win_size);
 #ifdef CONFIG_EVENT
 		event_schedule_event(&sock_info->event, EV_READ);
 #endif
@@ -773,14 +1212,19 @@ void tcp_input(pkt_t *pkt)
 	pkt_free(pkt);
 }
 
-#ifdef CONFIG_HT_STORAGE
-void tcp_init(void)
-{
-	htable_init(&tcp_conns);
-}
-
 void tcp_shutdown(void)
 {
-	htable_free(&tcp_conns);
+	int i;
+
+	for (i = 0; i < CONFIG_TCP_CONN_TABLE_SIZE; i++) {
+		tcp_conn_t *tcp_conn = tcp_conns[i];
+
+		if (tcp_conn == NULL)
+			continue;
+		tcp_conns[i] = NULL;
+		/* drop the connection without sending a FIN */
+		tcp_conn->syn.status = SOCK_CLOSED;
+		tcp_conn->sock_info = NULL;
+		__tcp_conn_delete(tcp_conn);
+	}
 }
-#endif
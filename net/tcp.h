@@ -29,6 +29,7 @@
 #include <sys/timer.h>
 #endif
 #include "config.h"
+#include "ip.h"
 #include "socket.h"
 
 #define TH_FIN  0x01
@@ -94,6 +95,12 @@ struct tcp_uid {
 } __PACKED__;
 typedef struct tcp_uid tcp_uid_t;
 
+/* sequence number comparisons (modulo 2^32) */
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
 #ifdef CONFIG_TCP_RETRANSMIT
 struct tcp_retrn_pkt {
 	pkt_t *pkt;
@@ -104,11 +111,34 @@ typedef struct tcp_retrn_pkt tcp_retrn_pkt_t;
 struct tcp_retrn {
 	tim_t timer;
 	uint8_t cnt;
+	uint8_t persist;	/* window probe backoff */
+	uint8_t dup_acks;
+	uint8_t timing;
 	list_t retrn_pkt_list;
+	uint32_t rtt_seqid;	/* sequence number being timed */
+	uint32_t rtt_ticks;	/* its transmission time */
+	uint32_t srtt;		/* smoothed round trip time (ticks * 8) */
+	uint32_t rttvar;	/* round trip time variation (ticks * 4) */
+	uint32_t rto;		/* retransmission timeout (ticks) */
 } __PACKED__;
 typedef struct tcp_retrn tcp_retrn_t;
 #endif
 
+/* connection lookup table size (power of 2, > CONFIG_TCP_MAX_CONNS) */
+#ifndef CONFIG_TCP_CONN_TABLE_SIZE
+#define CONFIG_TCP_CONN_TABLE_SIZE 8
+#endif
+
+/* maximum number of out of order segments kept per connection */
+#ifndef CONFIG_TCP_OOO_MAX_PKTS
+#define CONFIG_TCP_OOO_MAX_PKTS 0
+#endif
+
+/* maximum number of data segments waiting for the peer's window */
+#ifndef CONFIG_TCP_SND_QUEUE_MAX
+#define CONFIG_TCP_SND_QUEUE_MAX 8
+#endif
+
 struct tcp_options {
 	uint16_t mss;
 }  __PACKED__;
@@ -123,6 +153,17 @@ struct tcp_syn {
 } __PACKED__;
 typedef struct tcp_syn tcp_syn_t;
 
+/* send sequence space, host endian. The next sequence number to be
+ * sent (snd_nxt) is tcp_syn_t's seqid.
+ */
+struct tcp_snd {
+	uint32_t una;	/* oldest unacknowledged sequence number */
+	uint16_t wnd;	/* peer's advertised window */
+	list_t queue;	/* segments waiting for the window to open */
+	uint8_t queued;	/* number of segments in queue */
+} __PACKED__;
+typedef struct tcp_snd tcp_snd_t;
+
 struct sock_info;
 typedef struct sock_info sock_info_t;
 
@@ -131,6 +172,11 @@ struct tcp_conn {
 	sock_info_t *sock_info;
 	list_t list;
 	list_t pkt_list_head;
+	tcp_snd_t snd;
+#if CONFIG_TCP_OOO_MAX_PKTS > 0
+	list_t ooo_list;
+	uint8_t ooo_cnt;
+#endif
 #ifdef CONFIG_TCP_RETRANSMIT
 	tcp_retrn_t retrn;
 #endif
@@ -141,19 +187,48 @@ tcp_conn_t *tcp_conn_lookup(const tcp_uid_t *uid);
 int tcp_conn_add(tcp_conn_t *tcp_conn);
 void tcp_conn_delete(tcp_conn_t *tcp_conn);
 
+/* remove tcp_conn from the connection table without releasing it */
+void tcp_conn_unlink(tcp_conn_t *tcp_conn);
+
 /* like tcp_conn_delete but does not remove tcp_conn from active connections */
 void __tcp_conn_delete(tcp_conn_t *tcp_conn);
 
 int
 tcp_connect(uint32_t dst_addr, uint16_t dst_port, void *sock_info);
 int tcp_output(pkt_t *pkt, tcp_conn_t *tcp_conn, uint8_t flags);
-void tcp_input(pkt_t *pkt);
 
-#ifdef CONFIG_HT_STORAGE
-void tcp_init(void);
-void tcp_shutdown(void);
-#else
-static inline void tcp_init(void) {}
-static inline void tcp_shutdown(void) {}
+/* Send a data segment (or a FIN if the segment has no payload) within
+ * the peer's window. Segments that do not fit are queued and sent
+ * as acknowledgements open the window. A data segment is freed and
+ * refused when CONFIG_TCP_SND_QUEUE_MAX segments are already queued.
+ */
+int tcp_send(tcp_conn_t *tcp_conn, pkt_t *pkt);
+
+static inline int tcp_snd_queue_is_full(const tcp_conn_t *tcp_conn)
+{
+	return tcp_conn->snd.queued >= CONFIG_TCP_SND_QUEUE_MAX;
+}
+void tcp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info);
+
+/* smallest of the local MSS and the one announced by the peer */
+int tcp_conn_get_mss(const tcp_conn_t *tcp_conn);
+
+#ifdef CONFIG_TCP_RETRANSMIT
+/** Get connection's smoothed round trip time
+ *
+ * @param[in] tcp_conn  tcp connection
+ * @return round trip time in microseconds, 0 if not measured yet
+ */
+uint32_t tcp_conn_get_rtt(const tcp_conn_t *tcp_conn);
+
+/** Get connection's retransmission timeout
+ *
+ * @param[in] tcp_conn  tcp connection
+ * @return retransmission timeout in microseconds (without backoff)
+ */
+uint32_t tcp_conn_get_rto(const tcp_conn_t *tcp_conn);
 #endif
+
+static inline void tcp_init(void) {}
+void tcp_shutdown(void);
 #endif
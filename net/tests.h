@@ -25,10 +25,30 @@
 #ifndef _TEST_H_
 #define _TEST_H_
 
+int net_pkt_mempool_tests(void);
+int net_pkt_class_tests(void);
+int net_pkt_chain_tests(void);
 int net_arp_tests(void);
+#ifdef CONFIG_ARP_HASH
+int net_arp_cache_tests(void);
+#endif
+int net_arp_resolve_tests(void);
+int net_ip_proto_tests(void);
+#ifdef CONFIG_IP_FRAG
+int net_ip_frag_tests(void);
+#endif
+#ifdef CONFIG_IP_FORWARD
+int net_ip_forward_tests(void);
+#endif
 int net_icmp_tests(void);
 int net_udp_tests(void);
 int net_tcp_tests(void);
+int net_tcp_throughput_tests(void);
+int net_tcp_ooo_tests(void);
+int net_tcp_rto_tests(void);
+int net_tcp_segmentation_tests(void);
+int net_tcp_passive_close_tests(void);
+int net_tcp_conn_lookup_tests(void);
 int net_swen_generic_cmds_tests(void);
 int net_swen_l3_tests(void);
 
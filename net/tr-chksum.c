@@ -27,7 +27,8 @@
 
 /* len is in network byte order */
 uint16_t
-transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
+__transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len,
+		  int hdr_len, uint32_t payload_csum)
 {
 	uint32_t csum;
 
@@ -40,7 +41,8 @@ transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
 	csum += htons(ip->p);
 
 	csum += cksum_partial(&len, sizeof(len));
-	csum += cksum_partial(hdr, ntohs(len));
+	csum += cksum_partial(hdr, hdr_len);
+	csum += payload_csum;
 	csum = (csum & 0xFFFF) + (csum >> 16);
 	csum += csum >> 16;
 
@@ -48,7 +50,14 @@ transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
 	return csum;
 }
 
-void set_transport_cksum(const void *iph, void *trans_hdr, int len)
+uint16_t
+transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len)
+{
+	return __transport_cksum(ip, hdr, len, ntohs(len), 0);
+}
+
+void __set_transport_cksum(const void *iph, void *trans_hdr, int len,
+			   int hdr_len, uint32_t payload_csum)
 {
 	const ip_hdr_t *ip_hdr = iph;
 	uint16_t *checksum;
@@ -64,7 +73,13 @@ void set_transport_cksum(const void *iph, void *trans_hdr, int len)
 		return;
 	}
 	*checksum = 0;
-	*checksum = transport_cksum(ip_hdr, trans_hdr, len);
+	*checksum = __transport_cksum(ip_hdr, trans_hdr, len, hdr_len,
+				      payload_csum);
 	if (*checksum == 0)
 		*checksum = 0xFFFF;
 }
+
+void set_transport_cksum(const void *iph, void *trans_hdr, int len)
+{
+	__set_transport_cksum(iph, trans_hdr, len, ntohs(len), 0);
+}
@@ -33,4 +33,13 @@ void set_transport_cksum(const void *iph, void *trans_hdr, int len);
 uint16_t
 transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len);
 
+/* Same as above but only the hdr_len first bytes are read, the rest of
+ * the segment is accounted by payload_csum (see cksum_partial()).
+ */
+void __set_transport_cksum(const void *iph, void *trans_hdr, int len,
+			   int hdr_len, uint32_t payload_csum);
+uint16_t
+__transport_cksum(const ip_hdr_t *ip, const void *hdr, uint16_t len,
+		  int hdr_len, uint32_t payload_csum);
+
 #endif
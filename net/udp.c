@@ -35,7 +35,7 @@ int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport)
 	udp_hdr_t *udp_hdr = btod(pkt);
 	ip_hdr_t *ip_hdr;
 
-	udp_hdr->length = htons(pkt_len(pkt));
+	udp_hdr->length = htons(pkt_chain_len(pkt));
 
 	pkt_adj(pkt, -(int)sizeof(ip_hdr_t));
 	ip_hdr = btod(pkt);
@@ -47,20 +47,34 @@ int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport)
 	return ip_output(pkt, NULL, 0);
 }
 
-void udp_input(pkt_t *pkt, iface_t *iface)
+static uint16_t
+udp_cksum(const pkt_t *pkt, const ip_hdr_t *ip_hdr, const udp_hdr_t *udp_hdr)
+{
+#ifdef CONFIG_IP_FRAG
+	/* all fragments of a datagram but the last one carry 8 byte blocks */
+	if (pkt->next)
+		return __transport_cksum(ip_hdr, udp_hdr, udp_hdr->length,
+					 pkt_len(pkt),
+					 pkt_chain_cksum_partial(pkt->next));
+#endif
+	return transport_cksum(ip_hdr, udp_hdr, udp_hdr->length);
+}
+
+void udp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info)
 {
 	udp_hdr_t *udp_hdr;
-	ip_hdr_t *ip_hdr = btod(pkt);
+	ip_hdr_t *ip_hdr = info->hdr;
 	uint16_t length;
 	sock_info_t *sock_info;
-	uint16_t ip_hdr_len = ip_hdr->hl * 4;
+	uint16_t ip_hdr_len = info->hdr_len;
 
-	(void)iface;
 	pkt_adj(pkt, ip_hdr_len);
 	udp_hdr = btod(pkt);
 	length = ntohs(udp_hdr->length);
-	if (length < sizeof(udp_hdr_t) ||
-	    length > pkt_len(pkt) + sizeof(udp_hdr_t))
+	if (length < sizeof(udp_hdr_t) || length > info->plen)
+		goto error;
+	/* a reassembled datagram is not padded */
+	if (pkt->next && length != info->plen)
 		goto error;
 
 	if ((sock_info = udpport2sockinfo(udp_hdr->dst_port)) == NULL) {
@@ -68,12 +82,14 @@ void udp_input(pkt_t *pkt, iface_t *iface)
 		ip_hdr_t *ip_hdr_out;
 		pkt_t *out;
 		buf_t data;
+		/* only the first fragment of a datagram is quoted */
+		int len = pkt->next ? ip_hdr_len + pkt_len(pkt) :
+			ntohs(ip_hdr->len);
 
 		if ((out = pkt_alloc()) == NULL)
 			goto error;
 
-		buf_init(&data, ip_hdr, MIN(MAX_ICMP_DATA_SIZE,
-					    (uint16_t)ntohs(ip_hdr->len)));
+		buf_init(&data, ip_hdr, MIN(MAX_ICMP_DATA_SIZE, len));
 		pkt_adj(out, (int)sizeof(eth_hdr_t));
 		ip_hdr_out = btod(out);
 		ip_hdr_out->dst = ip_hdr->src;
@@ -87,13 +103,13 @@ void udp_input(pkt_t *pkt, iface_t *iface)
 		goto error;
 	}
 
-	if (udp_hdr->checksum && transport_cksum(ip_hdr, udp_hdr,
-						 udp_hdr->length) != 0)
+	if (udp_hdr->checksum && udp_cksum(pkt, ip_hdr, udp_hdr) != 0)
 		goto error;
 
 	pkt_adj(pkt, sizeof(udp_hdr_t));
 	/* truncate pkt to the udp payload length */
-	pkt->buf.len = length - sizeof(udp_hdr_t);
+	if (pkt->next == NULL)
+		pkt->buf.len = length - sizeof(udp_hdr_t);
 
 	pkt_adj(pkt, -(sizeof(udp_hdr_t) + ip_hdr_len));
 	socket_append_pkt(&sock_info->trq.pkt_list, pkt);
@@ -103,6 +119,6 @@ void udp_input(pkt_t *pkt, iface_t *iface)
 	return;
 
  error:
-	pkt_free(pkt);
+	pkt_chain_free(pkt);
 	/* inc stats */
 }
@@ -26,6 +26,7 @@
 #define _UDP_H_
 
 #include "config.h"
+#include "ip.h"
 
 struct udp_hdr {
 	uint16_t src_port;
@@ -36,7 +37,7 @@ struct udp_hdr {
 
 typedef struct udp_hdr udp_hdr_t;
 
-void udp_input(pkt_t *pkt, iface_t *iface);
+void udp_input(pkt_t *pkt, iface_t *iface, const ip_info_t *info);
 int udp_output(pkt_t *pkt, uint32_t ip_dst, uint16_t sport, uint16_t dport);
 
 #endif
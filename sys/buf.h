@@ -33,6 +33,7 @@
 #include <ctype.h>
 #include "log.h"
 #include "utils.h"
+#include "chksum.h"
 
 /** Static buffer
  */
@@ -253,6 +254,25 @@ static inline int buf_add(buf_t *buf, const void *data, int len)
 	return 0;
 }
 
+/** Add data to a buffer and accumulate its partial checksum
+ *
+ * The data is summed as if it started at an even offset.
+ * @param[in]     buf   buffer
+ * @param[in]     data  data
+ * @param[in]     len   data length
+ * @param[in,out] csum  partial checksum
+ * @return 0 on success, -1 if there is no room left
+ */
+static inline int
+buf_add_and_csum(buf_t *buf, const void *data, int len, uint32_t *csum)
+{
+	if (buf_has_room(buf, len) < 0)
+		return -1;
+	*csum += cksum_partial_copy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
 static inline int buf_addc(buf_t *buf, uint8_t c)
 {
 	return buf_add(buf, &c, 1);
@@ -336,6 +356,25 @@ static inline int buf_get(buf_t *buf, void *data, int len)
 	return 0;
 }
 
+/** Get data from a buffer and accumulate its partial checksum
+ *
+ * The data is summed as if it started at an even offset.
+ * @param[in]     buf   buffer
+ * @param[out]    data  data
+ * @param[in]     len   data length
+ * @param[in,out] csum  partial checksum
+ * @return 0 on success, -1 if the buffer is too short
+ */
+static inline int
+buf_get_and_csum(buf_t *buf, void *data, int len, uint32_t *csum)
+{
+	if (buf->len < len)
+		return -1;
+	*csum += cksum_partial_copy(data, buf->data, len);
+	__buf_skip(buf, len);
+	return 0;
+}
+
 static inline void buf_skip_spaces(buf_t *buf)
 {
 	while (buf->len && isspace(buf->data[0]))
@@ -23,9 +23,10 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 #include "chksum.h"
 
-uint32_t cksum_partial(const void *data, uint16_t len)
+static inline uint32_t cksum_partial_words(const void *data, uint16_t len)
 {
 	const uint16_t *w = data;
 	uint32_t sum = 0;
@@ -41,6 +42,151 @@ uint32_t cksum_partial(const void *data, uint16_t len)
 	return sum;
 }
 
+#ifdef X86
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* fold to 16 bits so that callers can keep adding partial sums */
+static inline uint32_t cksum_fold64(uint64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (sum & 0xffff) + (sum >> 16);
+}
+
+uint32_t __cksum_partial(const void *data, uint16_t len)
+{
+	return cksum_partial_words(data, len);
+}
+
+#ifdef __SSE2__
+/* 16-bit words are widened into 32-bit lanes. A lane gets two words
+ * per 16 bytes and cannot overflow for a 16-bit length.
+ */
+uint32_t cksum_partial(const void *data, uint16_t len)
+{
+	const uint8_t *p = data;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	uint32_t lanes[4];
+	uint64_t sum;
+
+	while (len >= 32) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)p);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v1, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v1, zero));
+		p += 32;
+		len -= 32;
+	}
+	if (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v, zero));
+		p += 16;
+		len -= 16;
+	}
+	_mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(acc0, acc1));
+	sum = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	return cksum_fold64(sum + cksum_partial_words(p, len));
+}
+
+uint32_t cksum_partial_copy(void *dst, const void *src, uint16_t len)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	uint32_t lanes[4];
+	uint64_t sum;
+
+	while (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+
+		_mm_storeu_si128((__m128i *)d, v);
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v, zero));
+		s += 16;
+		d += 16;
+		len -= 16;
+	}
+	_mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(acc0, acc1));
+	sum = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	memcpy(d, s, len);
+
+	return cksum_fold64(sum + cksum_partial_words(d, len));
+}
+#else
+/* 2^16 = 1 modulo 0xffff: summing 32-bit halves of 64-bit words gives
+ * the same one's complement sum as 16-bit words.
+ */
+uint32_t cksum_partial(const void *data, uint16_t len)
+{
+	const uint8_t *p = data;
+	uint64_t sum = 0;
+
+	while (len >= 16) {
+		uint64_t w0, w1;
+
+		memcpy(&w0, p, sizeof(w0));
+		memcpy(&w1, p + 8, sizeof(w1));
+		sum += (w0 & 0xffffffff) + (w0 >> 32);
+		sum += (w1 & 0xffffffff) + (w1 >> 32);
+		p += 16;
+		len -= 16;
+	}
+	if (len >= 8) {
+		uint64_t w;
+
+		memcpy(&w, p, sizeof(w));
+		sum += (w & 0xffffffff) + (w >> 32);
+		p += 8;
+		len -= 8;
+	}
+	return cksum_fold64(sum + cksum_partial_words(p, len));
+}
+
+uint32_t cksum_partial_copy(void *dst, const void *src, uint16_t len)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	uint64_t sum = 0;
+
+	while (len >= 8) {
+		uint64_t w;
+
+		memcpy(&w, s, sizeof(w));
+		memcpy(d, &w, sizeof(w));
+		sum += (w & 0xffffffff) + (w >> 32);
+		s += 8;
+		d += 8;
+		len -= 8;
+	}
+	memcpy(d, s, len);
+	return cksum_fold64(sum + cksum_partial_words(d, len));
+}
+#endif
+#else
+uint32_t cksum_partial(const void *data, uint16_t len)
+{
+	return cksum_partial_words(data, len);
+}
+
+/* no cache to save on small targets, copy then sum */
+uint32_t cksum_partial_copy(void *dst, const void *src, uint16_t len)
+{
+	memcpy(dst, src, len);
+	return cksum_partial_words(dst, len);
+}
+#endif
+
 uint16_t cksum_finish(uint32_t csum)
 {
 	csum = (csum >> 16) + (csum & 0xffff);
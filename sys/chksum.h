@@ -30,4 +30,66 @@ uint16_t cksum(const void *data, uint16_t len);
 uint32_t cksum_partial(const void *data, uint16_t len);
 uint16_t cksum_finish(uint32_t csum);
 
+/** Copy data and compute its partial checksum
+ *
+ * @param[out] dst  destination
+ * @param[in]  src  source
+ * @param[in]  len  length
+ * @return partial checksum of the copied data, see cksum_partial()
+ */
+uint32_t cksum_partial_copy(void *dst, const void *src, uint16_t len);
+
+/** Fold a partial checksum to 16 bits without complementing it
+ *
+ * @param[in] csum  partial checksum
+ * @return folded checksum
+ */
+static inline uint16_t cksum_fold(uint32_t csum)
+{
+	csum = (csum >> 16) + (csum & 0xffff);
+	csum += csum >> 16;
+	return csum;
+}
+
+#ifdef X86
+/* portable 16-bit word version of cksum_partial() (reference) */
+uint32_t __cksum_partial(const void *data, uint16_t len);
+#endif
+
+/** Update a checksum after a 16-bit field change (RFC 1624)
+ *
+ * HC' = ~(~HC + ~m + m')
+ * Fields are given as they are stored in the packet.
+ *
+ * @param[in] csum     checksum
+ * @param[in] old_val  previous field value
+ * @param[in] new_val  new field value
+ * @return updated checksum
+ */
+static inline uint16_t
+cksum_update16(uint16_t csum, uint16_t old_val, uint16_t new_val)
+{
+	uint32_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~old_val;
+	sum += new_val;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum += sum >> 16;
+	return ~sum;
+}
+
+/** Update a checksum after a 32-bit field change (RFC 1624)
+ *
+ * @param[in] csum     checksum
+ * @param[in] old_val  previous field value
+ * @param[in] new_val  new field value
+ * @return updated checksum
+ */
+static inline uint16_t
+cksum_update32(uint16_t csum, uint32_t old_val, uint32_t new_val)
+{
+	csum = cksum_update16(csum, old_val >> 16, new_val >> 16);
+	return cksum_update16(csum, old_val & 0xffff, new_val & 0xffff);
+}
+
 #endif
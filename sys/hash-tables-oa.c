@@ -0,0 +1,184 @@
+/*
+ * microdevt - Microcontroller Development Toolkit
+ *
+ * Copyright (c) 2017, Krzysztof Witek
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "LICENSE".
+ *
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash-tables.h"
+
+/* Open addressing hash table: keys and values are stored inline in a
+ * single array of slots (no allocation), collisions are resolved by
+ * linear probing and entries are removed with backward shift deletion.
+ */
+
+/* Jenkins one-at-a-time hash */
+static uint32_t hash_function(const sbuf_t *key)
+{
+	uint32_t hash = 0;
+	int i;
+
+	for (i = 0; i < key->len; i++) {
+		hash += key->data[i];
+		hash += hash << 10;
+		hash ^= hash >> 6;
+	}
+	hash += hash << 3;
+	hash ^= hash >> 11;
+	hash += hash << 15;
+	return hash;
+}
+
+static inline int htable_mask(const hash_table_t *htable)
+{
+	return htable->size - 1;
+}
+
+static int __htable_lookup(const hash_table_t *htable, uint32_t hash,
+			   const sbuf_t *key)
+{
+	int mask = htable_mask(htable);
+	int i = hash & mask;
+	int n;
+
+	for (n = 0; n < htable->size; n++) {
+		const htable_slot_t *slot = &htable->slots[i];
+
+		if (slot->key.len == 0)
+			return -1;
+		if (slot->hash == hash && slot->key.len == key->len
+		    && memcmp(slot->key.data, key->data, key->len) == 0)
+			return i;
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+int htable_lookup(const hash_table_t *htable, const sbuf_t *key,
+		  sbuf_t **val)
+{
+	int i = __htable_lookup(htable, hash_function(key), key);
+
+	if (i < 0)
+		return -1;
+	*val = &htable->slots[i].val;
+	return i;
+}
+
+static void htable_slot_move(htable_slot_t *dst, const htable_slot_t *src)
+{
+	*dst = *src;
+	dst->key.data = dst->key_data;
+	dst->val.data = dst->val_data;
+}
+
+int htable_add(hash_table_t *htable, const sbuf_t *key, sbuf_t *val)
+{
+	uint32_t hash = hash_function(key);
+	int mask = htable_mask(htable);
+	int i = hash & mask;
+	htable_slot_t *slot;
+
+	if (key->len <= 0 || key->len > CONFIG_HT_KEY_SIZE
+	    || val->len > (int)CONFIG_HT_VAL_SIZE || htable->len >= htable->size)
+		return -1;
+
+	/* if the key already exists do not insert it again */
+	if (__htable_lookup(htable, hash, key) >= 0)
+		return -1;
+
+	while (htable->slots[i].key.len)
+		i = (i + 1) & mask;
+
+	slot = &htable->slots[i];
+	slot->hash = hash;
+	memcpy(slot->key_data, key->data, key->len);
+	sbuf_init(&slot->key, slot->key_data, key->len);
+	memcpy(slot->val_data, val->data, val->len);
+	sbuf_init(&slot->val, slot->val_data, val->len);
+	val->data = slot->val_data;
+	htable->len++;
+
+	return 0;
+}
+
+static void htable_del_slot(hash_table_t *htable, int i)
+{
+	int mask = htable_mask(htable);
+	int j = i;
+
+	for (;;) {
+		int k;
+
+		j = (j + 1) & mask;
+		if (htable->slots[j].key.len == 0)
+			break;
+		k = htable->slots[j].hash & mask;
+		/* keep the entry if its home slot lies in ]i, j] */
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		htable_slot_move(&htable->slots[i], &htable->slots[j]);
+		i = j;
+	}
+	htable->slots[i].key.len = 0;
+	htable->len--;
+}
+
+void htable_del_val(hash_table_t *htable, sbuf_t *val)
+{
+	htable_slot_t *slot = container_of(val, htable_slot_t, val);
+
+	htable_del_slot(htable, slot - htable->slots);
+}
+
+int htable_del(hash_table_t *htable, const sbuf_t *key)
+{
+	int i = __htable_lookup(htable, hash_function(key), key);
+
+	if (i < 0)
+		return -1;
+	htable_del_slot(htable, i);
+	assert(htable->len >= 0);
+	return 0;
+}
+
+/* deletions shift entries, the callback must not modify the table */
+void htable_for_each(hash_table_t *htable,
+		     int (*cb)(sbuf_t *key, sbuf_t *val, void **arg),
+		     void **arg)
+{
+	int i;
+
+	for (i = 0; i < htable->size; i++) {
+		htable_slot_t *slot = &htable->slots[i];
+
+		if (slot->key.len && cb(&slot->key, &slot->val, arg) < 0)
+			return;
+	}
+}
+
+void htable_free(hash_table_t *htable)
+{
+	memset(htable->slots, 0, htable->size * sizeof(htable_slot_t));
+	htable->len = 0;
+}
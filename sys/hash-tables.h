@@ -29,6 +29,48 @@
 #include "list.h"
 #include "buf.h"
 
+#ifdef CONFIG_HT_OPEN_ADDRESSING
+#include <string.h>
+
+/* maximum key and value sizes stored inline in the table slots */
+#ifndef CONFIG_HT_KEY_SIZE
+#define CONFIG_HT_KEY_SIZE 4
+#endif
+#ifndef CONFIG_HT_VAL_SIZE
+#define CONFIG_HT_VAL_SIZE sizeof(void *)
+#endif
+
+typedef struct htable_slot {
+	sbuf_t key;		/* key.len == 0: free slot */
+	sbuf_t val;
+	uint32_t hash;
+	uint8_t key_data[CONFIG_HT_KEY_SIZE];
+	uint8_t val_data[CONFIG_HT_VAL_SIZE];
+} htable_slot_t;
+
+typedef struct hash_table {
+	int size;
+	int len;
+	htable_slot_t *slots;
+} hash_table_t;
+
+static inline void htable_init(hash_table_t *htable)
+{
+	if (htable->size < 1 || !POWEROF2(htable->size))
+		__abort();
+	memset(htable->slots, 0, htable->size * sizeof(htable_slot_t));
+	htable->len = 0;
+}
+
+/* htable size must be a power of 2 */
+#define HTABLE_DECL(name, htable_size)			\
+	htable_slot_t name##__htable_slots[htable_size];	\
+	hash_table_t name = {				\
+		.size = htable_size,			\
+		.len = 0,				\
+		.slots = name##__htable_slots,		\
+	}
+#else
 typedef struct node {
 	sbuf_t key;
 	sbuf_t val;
@@ -59,7 +101,14 @@ static inline void htable_init(hash_table_t *htable)
 		.len = 0,				\
 		.list_head = name##__htable_list,	\
 	}
+#endif
 
+/* With CONFIG_HT_OPEN_ADDRESSING, entries are stored in the table and
+ * deleting one may move others: the values returned by htable_lookup(),
+ * htable_add() and htable_for_each() are only valid until the next
+ * deletion and the htable_for_each() callback must not add or delete
+ * entries.
+ */
 int
 htable_lookup(const hash_table_t *htable, const sbuf_t *key, sbuf_t **val);
 int htable_add(hash_table_t *htable, const sbuf_t *key, sbuf_t *val);
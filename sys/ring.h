@@ -170,6 +170,110 @@ static inline int ring_free_entries(const ring_t *ring)
 	return ring->mask - ring_len(ring);
 }
 
+/** Contiguous region of ring memory
+ */
+typedef struct ring_span {
+	uint8_t *data;
+	int len;
+} ring_span_t;
+
+/** Split a ring region into at most two contiguous spans
+ *
+ * @param[in]  ring  ring
+ * @param[in]  pos   start position
+ * @param[in]  len   region length
+ * @param[out] span  spans, the second one is empty if the region
+ *                   does not wrap
+ * @return number of non-empty spans
+ */
+static inline int
+__ring_spans(const ring_t *ring, int pos, int len, ring_span_t span[2])
+{
+	int first = ring->mask + 1 - pos;
+
+	span[0].data = (uint8_t *)&ring->data[pos];
+	if (len <= first) {
+		span[0].len = len;
+		span[1].data = (uint8_t *)ring->data;
+		span[1].len = 0;
+		return len ? 1 : 0;
+	}
+	span[0].len = first;
+	span[1].data = (uint8_t *)ring->data;
+	span[1].len = len - first;
+	return 2;
+}
+
+/** Get ring content as contiguous spans
+ *
+ * The data can be read in place, then released with ring_skip().
+ * @param[in]  ring  ring
+ * @param[out] span  spans
+ * @return number of non-empty spans
+ */
+static inline int ring_data_spans(const ring_t *ring, ring_span_t span[2])
+{
+	return __ring_spans(ring, ring->tail, ring_len(ring), span);
+}
+
+/** Reserve room in ring
+ *
+ * The producer writes up to len bytes directly in the returned spans,
+ * then publishes them with ring_commit().
+ * @param[in]  ring  ring
+ * @param[in]  len   length to reserve
+ * @param[out] span  spans
+ * @return 0 on success, -1 if there is not enough room
+ */
+static inline int ring_reserve(ring_t *ring, int len, ring_span_t span[2])
+{
+	if (len > ring_free_entries(ring))
+		return -1;
+	__ring_spans(ring, ring->head, len, span);
+	return 0;
+}
+
+/** Publish data written in reserved room
+ *
+ * @param[in] ring ring
+ * @param[in] len  length written, not more than the reserved length
+ */
+static inline void ring_commit(ring_t *ring, int len)
+{
+	ring->head = (ring->head + len) & ring->mask;
+}
+
+/** Add data to ring without checking
+ *
+ * @param[in] ring ring
+ * @param[in] data pointer to data to add
+ * @param[in] len  data length
+ */
+static inline void __ring_add(ring_t *ring, const void *data, int len)
+{
+	ring_span_t span[2];
+
+	__ring_spans(ring, ring->head, len, span);
+	memcpy(span[0].data, data, span[0].len);
+	memcpy(span[1].data, (const uint8_t *)data + span[0].len, span[1].len);
+	ring_commit(ring, len);
+}
+
+/** Copy data from ring without skipping it
+ *
+ * @param[in]  ring ring
+ * @param[out] data destination
+ * @param[in]  len  data length, not more than the ring length
+ */
+static inline void __ring_peek(const ring_t *ring, void *data, int len)
+{
+	ring_span_t span[2];
+
+	__ring_spans(ring, ring->tail, len, span);
+	memcpy(data, span[0].data, span[0].len);
+	memcpy((uint8_t *)data + span[0].len, span[1].data, span[1].len);
+}
+
 /** Add byte to ring without checking
  *
  * @param[in] ring  ring
@@ -202,11 +306,7 @@ static inline int ring_addc(ring_t *ring, uint8_t c)
  */
 static inline void __ring_addbuf(ring_t *ring, const buf_t *buf)
 {
-	int i;
-	uint8_t *d = buf->data;
-
-	for (i = 0; i < buf->len; i++)
-		__ring_addc(ring, d[i]);
+	__ring_add(ring, buf->data, buf->len);
 }
 
 /** Add buffer to ring
@@ -232,13 +332,9 @@ static inline int ring_addbuf(ring_t *ring, const buf_t *buf)
  */
 static inline int ring_add(ring_t *ring, const void *data, int len)
 {
-	int i;
-	const uint8_t *d = data;
-
 	if (len > ring_free_entries(ring))
 		return -1;
-	for (i = 0; i < len; i++)
-		__ring_addc(ring, d[i]);
+	__ring_add(ring, data, len);
 	return 0;
 }
 
@@ -276,15 +372,11 @@ static inline void __ring_getc(ring_t *ring, uint8_t *c)
 static inline int
 __ring_get_dont_skip(const ring_t *ring, buf_t *buf, int len)
 {
-	int i;
 	int blen = buf_get_free_space(buf);
 	int l = MIN(blen, len);
 
-	for (i = 0; i < l; i++) {
-		int pos = (ring->tail + i) & ring->mask;
-
-		__buf_addc(buf, ring->data[pos]);
-	}
+	__ring_peek(ring, buf->data + buf->len, l);
+	buf->len += l;
 	return l;
 }
 
@@ -373,13 +465,8 @@ static inline int __ring_get(ring_t *ring, buf_t *buf, int max_len)
  */
 static inline void __ring_get_buf(ring_t *ring, buf_t *buf)
 {
-	int i;
-
-	for (i = 0; i < buf->size; i++) {
-		int pos = (ring->tail + i) & ring->mask;
-
-		__buf_addc(buf, ring->data[pos]);
-	}
+	__ring_peek(ring, buf->data + buf->len, buf->size);
+	buf->len += buf->size;
 	__ring_skip(ring, buf->len);
 }
 
@@ -544,4 +631,233 @@ __ring_cksum(const ring_t *ring, int len)
 	}
 	return cksum_finish(csum);
 }
+
+#ifndef CONFIG_AVR_MCU
+/** Multi producer - multi consumer ring of fixed size elements
+ *
+ * Producers reserve room by moving prod.head with compare & set, copy
+ * their elements, then publish them by moving prod.tail in reservation
+ * order. Consumers do the same with the cons indexes. The sp/sc
+ * functions skip the compare & set when a side has a single thread.
+ * Indexes are free running, the ring holds up to mask + 1 elements.
+ */
+
+#define RING_MP_ALIGN 64
+
+typedef struct ring_mp_headtail {
+	volatile unsigned head;
+	volatile unsigned tail;
+} __attribute__((aligned(RING_MP_ALIGN))) ring_mp_headtail_t;
+
+typedef struct ring_mp {
+	ring_mp_headtail_t prod;
+	ring_mp_headtail_t cons;
+	unsigned mask;
+	unsigned esize;
+	uint8_t data[] __attribute__((aligned(RING_MP_ALIGN)));
+} ring_mp_t;
+
+/** Multi producer ring declaration in C structures
+ *
+ * The number of elements MUST be a power of 2.
+ *
+ * Example of usage:
+ *  struct {
+ *	RING_MP_DECL_IN_STRUCT(my_ring, 64, sizeof(void *));
+ *   } a = {
+ *	.my_ring = RING_MP_INIT(a.my_ring, sizeof(void *)),
+ * };
+ */
+#define RING_MP_DECL_IN_STRUCT(name, nb, esize)		\
+	ring_mp_t name;						\
+	uint8_t name##_data[(nb) * (esize)];
+
+/** Initialize multi producer ring at compile time
+ *
+ * @param[in] name  ring name
+ * @param[in] size  element size
+ */
+#define RING_MP_INIT(name, size) {				\
+		.mask = sizeof(name##_data) / (size) - 1,	\
+		.esize = (size),				\
+	}
+
+/** Initialize multi producer ring
+ *
+ * @param[in] ring   ring followed by nb * esize bytes
+ * @param[in] nb     number of elements, power of 2
+ * @param[in] esize  element size
+ */
+static inline void ring_mp_init(ring_mp_t *ring, unsigned nb, unsigned esize)
+{
+	if (!POWEROF2(nb))
+		__abort();
+	ring->prod.head = ring->prod.tail = 0;
+	ring->cons.head = ring->cons.tail = 0;
+	ring->mask = nb - 1;
+	ring->esize = esize;
+}
+
+/** Get multi producer ring length
+ *
+ * The result is a snapshot when other threads use the ring.
+ * @param[in] ring ring
+ * @return number of elements
+ */
+static inline unsigned ring_mp_len(const ring_mp_t *ring)
+{
+	return __atomic_load_n(&ring->prod.tail, __ATOMIC_ACQUIRE)
+		- __atomic_load_n(&ring->cons.tail, __ATOMIC_ACQUIRE);
+}
+
+/** Check if multi producer ring is empty
+ *
+ * @param[in] ring ring
+ * @return 1 if empty, 0 otherwise
+ */
+static inline uint8_t ring_mp_is_empty(const ring_mp_t *ring)
+{
+	return ring_mp_len(ring) == 0;
+}
+
+static inline void
+__ring_mp_copy_in(ring_mp_t *ring, unsigned pos, const void *data, unsigned n)
+{
+	unsigned idx = (pos & ring->mask) * ring->esize;
+	unsigned len = n * ring->esize;
+	unsigned size = (ring->mask + 1) * ring->esize;
+
+	if (idx + len <= size) {
+		memcpy(&ring->data[idx], data, len);
+		return;
+	}
+	memcpy(&ring->data[idx], data, size - idx);
+	memcpy(ring->data, (const uint8_t *)data + size - idx,
+	       len - (size - idx));
+}
+
+static inline void
+__ring_mp_copy_out(const ring_mp_t *ring, unsigned pos, void *data, unsigned n)
+{
+	unsigned idx = (pos & ring->mask) * ring->esize;
+	unsigned len = n * ring->esize;
+	unsigned size = (ring->mask + 1) * ring->esize;
+
+	if (idx + len <= size) {
+		memcpy(data, &ring->data[idx], len);
+		return;
+	}
+	memcpy(data, &ring->data[idx], size - idx);
+	memcpy((uint8_t *)data + size - idx, ring->data, len - (size - idx));
+}
+
+/* wait for the previous reservations to be published */
+static inline void
+__ring_mp_update_tail(ring_mp_headtail_t *ht, unsigned old, unsigned new,
+		      uint8_t single)
+{
+	if (!single)
+		while (__atomic_load_n(&ht->tail, __ATOMIC_RELAXED) != old)
+			__builtin_ia32_pause();
+	__atomic_store_n(&ht->tail, new, __ATOMIC_RELEASE);
+}
+
+static inline int
+__ring_mp_enqueue_bulk(ring_mp_t *ring, const void *data, unsigned n,
+		       uint8_t single)
+{
+	unsigned head, free_entries;
+
+	do {
+		head = ring->prod.head;
+		free_entries = ring->mask + 1 + __atomic_load_n(&ring->cons.tail,
+							__ATOMIC_ACQUIRE) - head;
+		if (n > free_entries)
+			return -1;
+		if (single) {
+			ring->prod.head = head + n;
+			break;
+		}
+	} while (!__sync_bool_compare_and_swap(&ring->prod.head, head,
+					       head + n));
+	__ring_mp_copy_in(ring, head, data, n);
+	__ring_mp_update_tail(&ring->prod, head, head + n, single);
+	return 0;
+}
+
+static inline int
+__ring_mc_dequeue_bulk(ring_mp_t *ring, void *data, unsigned n,
+		       uint8_t single)
+{
+	unsigned head, entries;
+
+	do {
+		head = ring->cons.head;
+		entries = __atomic_load_n(&ring->prod.tail, __ATOMIC_ACQUIRE)
+			- head;
+		if (n > entries)
+			return -1;
+		if (single) {
+			ring->cons.head = head + n;
+			break;
+		}
+	} while (!__sync_bool_compare_and_swap(&ring->cons.head, head,
+					       head + n));
+	__ring_mp_copy_out(ring, head, data, n);
+	__ring_mp_update_tail(&ring->cons, head, head + n, single);
+	return 0;
+}
+
+/** Add elements to ring, safe with concurrent producers
+ *
+ * Either all the elements are added or none.
+ * @param[in] ring ring
+ * @param[in] data elements
+ * @param[in] n    number of elements
+ * @return 0 on success, -1 if there is not enough room
+ */
+static inline int
+ring_mp_enqueue_bulk(ring_mp_t *ring, const void *data, unsigned n)
+{
+	return __ring_mp_enqueue_bulk(ring, data, n, 0);
+}
+
+/** Add elements to ring, single producer
+ *
+ * @param[in] ring ring
+ * @param[in] data elements
+ * @param[in] n    number of elements
+ * @return 0 on success, -1 if there is not enough room
+ */
+static inline int
+ring_sp_enqueue_bulk(ring_mp_t *ring, const void *data, unsigned n)
+{
+	return __ring_mp_enqueue_bulk(ring, data, n, 1);
+}
+
+/** Get elements from ring, safe with concurrent consumers
+ *
+ * Either all the elements are removed or none.
+ * @param[in] ring  ring
+ * @param[out] data elements
+ * @param[in] n     number of elements
+ * @return 0 on success, -1 if there are not enough elements
+ */
+static inline int ring_mc_dequeue_bulk(ring_mp_t *ring, void *data, unsigned n)
+{
+	return __ring_mc_dequeue_bulk(ring, data, n, 0);
+}
+
+/** Get elements from ring, single consumer
+ *
+ * @param[in] ring  ring
+ * @param[out] data elements
+ * @param[in] n     number of elements
+ * @return 0 on success, -1 if there are not enough elements
+ */
+static inline int ring_sc_dequeue_bulk(ring_mp_t *ring, void *data, unsigned n)
+{
+	return __ring_mc_dequeue_bulk(ring, data, n, 1);
+}
+#endif
 #endif
@@ -22,6 +22,7 @@
  *
 */
 
+#include <string.h>
 #include <interrupts.h>
 #include "power-management.h"
 #include "ring.h"
@@ -41,67 +42,389 @@ typedef struct __PACKED__ task {
 #define SCHEDULER_TASK_WATER_MARK				\
 	(CONFIG_SCHEDULER_TASK_WATER_MARK * sizeof(task_t))
 
-#define RING_SIZE (CONFIG_SCHEDULER_MAX_TASKS * sizeof(task_t))
+/* a waiting task is run after being passed over that many times */
+#ifndef CONFIG_SCHEDULER_AGING
+#define CONFIG_SCHEDULER_AGING 8
+#endif
+
+#define RING_SIZE ROUNDUP_PWR2(CONFIG_SCHEDULER_MAX_TASKS * sizeof(task_t))
+
+/* one pair of rings per priority level, tasks scheduled from an
+ * interrupt handler go to the irq ring.
+ */
+typedef struct sched_queue {
+	RING_DECL_IN_STRUCT(ring, RING_SIZE);
+	RING_DECL_IN_STRUCT(ring_irq, RING_SIZE);
+	/* embedded tasks that did not fit in the rings, lazily initialized */
+	list_t overflow;
+	uint8_t age;
+	uint8_t high_water_mark;
+	uint8_t irq_high_water_mark;
+} sched_queue_t;
+
+#define SCHED_QUEUE_INIT(name) {			\
+		.ring = RING_INIT(name.ring),		\
+		.ring_irq = RING_INIT(name.ring_irq),	\
+	}
+
+static sched_queue_t queues[CONFIG_SCHEDULER_PRIO_NB] = {
+	[0 ... CONFIG_SCHEDULER_PRIO_NB - 1] = SCHED_QUEUE_INIT(queues[0]),
+};
+
+static scheduler_stats_t stats;
+
+#if CONFIG_SCHEDULER_CPUS > 1
+#define SCHED_REMOTE_NB ROUNDUP_PWR2(CONFIG_SCHEDULER_MAX_TASKS)
 
-STATIC_RING_DECL(ring, ROUNDUP_PWR2(RING_SIZE));
-STATIC_RING_DECL(ring_irq, ROUNDUP_PWR2(RING_SIZE));
+/* tasks sent to a cpu by any thread, only that cpu consumes them */
+typedef struct sched_remote {
+	RING_MP_DECL_IN_STRUCT(ring, SCHED_REMOTE_NB, sizeof(task_t));
+} sched_remote_t;
+
+static sched_remote_t remote_queues[CONFIG_SCHEDULER_CPUS] = {
+	[0 ... CONFIG_SCHEDULER_CPUS - 1] = {
+		.ring = RING_MP_INIT(remote_queues[0].ring, sizeof(task_t)),
+	},
+};
+static __thread uint8_t sched_cpu;
+#else
+#define sched_cpu 0
+#endif
 
 #ifdef CONFIG_POWER_MANAGEMENT
 static uint8_t idle;
 #endif
 
+/* Rings only hold task records and their size is a multiple of the
+ * record size, so a record never wraps and is copied at once.
+ */
 static void __scheduler_run_task(ring_t *r)
 {
 	task_t task;
-	buf_t buf = BUF_INIT(&task, sizeof(task_t));
 #ifdef DEBUG
 	int rlen = ring_len(r);
 
 	assert(rlen > 0);
 	assert(rlen % sizeof(task_t) == 0);
 #endif
-	__ring_get_buf(r, &buf);
+	memcpy(&task, &r->data[r->tail], sizeof(task_t));
+	r->tail = (r->tail + sizeof(task_t)) & r->mask;
 	task.cb(task.arg);
 #ifdef CONFIG_POWER_MANAGEMENT
 	idle = 0;
 #endif
 }
 
+static inline sched_queue_t *sched_queue_get(uint8_t prio)
+{
+	if (prio >= CONFIG_SCHEDULER_PRIO_NB)
+		prio = CONFIG_SCHEDULER_PRIO_NB - 1;
+	return &queues[prio];
+}
+
+static int sched_queue_add(sched_queue_t *q, void (*cb)(void *arg), void *arg)
+{
+	task_t task = {
+		.cb = cb,
+		.arg = arg,
+	};
+	ring_t *r;
+	uint8_t *hwm;
+	uint8_t len;
+
+	if (IRQ_CHECK()) {
+		r = &q->ring;
+		hwm = &q->high_water_mark;
+	} else {
+		r = &q->ring_irq;
+		hwm = &q->irq_high_water_mark;
+	}
+
+	STATIC_ASSERT(POWEROF2(sizeof(task_t)));
+	if (ring_free_entries(r) >= (int)sizeof(task_t)) {
+		memcpy(&r->data[r->head], &task, sizeof(task_t));
+		r->head = (r->head + sizeof(task_t)) & r->mask;
+		len = ring_len(r) / sizeof(task_t);
+		if (len > *hwm)
+			*hwm = len;
+		return 0;
+	}
+	return -1;
+}
+
+static inline uint8_t sched_overflow_is_empty(const sched_queue_t *q)
+{
+	return q->overflow.next == NULL || list_empty(&q->overflow);
+}
+
 #ifdef DEBUG
-void __schedule_task(void (*cb)(void *arg), void *arg,
-		     const char *func, int line)
+void __schedule_task_prio(void (*cb)(void *arg), void *arg, uint8_t prio,
+			  const char *func, int line)
 #else
-void schedule_task(void (*cb)(void *arg), void *arg)
+void schedule_task_prio(void (*cb)(void *arg), void *arg, uint8_t prio)
 #endif
+{
+	if (sched_queue_add(sched_queue_get(prio), cb, arg) >= 0)
+		return;
+	stats.dropped++;
+	DEBUG_LOG("cannot schedule task %p from %s:%d\n", cb, func, line);
+}
+
+void schedule_embedded_task(sched_task_t *task, uint8_t prio)
+{
+	sched_queue_t *q = sched_queue_get(prio);
+	uint8_t flags;
+
+	irq_save(flags);
+	/* already waiting on the overflow list */
+	if (!list_empty(&task->list))
+		goto end;
+	if (sched_queue_add(q, task->cb, task->arg) >= 0)
+		goto end;
+	if (q->overflow.next == NULL)
+		INIT_LIST_HEAD(&q->overflow);
+	list_add_tail(&task->list, &q->overflow);
+	stats.overflowed++;
+ end:
+	irq_restore(flags);
+}
+
+static void sched_task_nop(void *arg) {}
+
+/* A record already in a ring cannot be removed, it is turned into a
+ * no-op so that it does not run with the argument of a freed owner.
+ */
+static void sched_ring_cancel(ring_t *r, const sched_task_t *task)
+{
+	unsigned pos;
+
+	for (pos = r->tail; pos != r->head;
+	     pos = (pos + sizeof(task_t)) & r->mask) {
+		task_t *t = (task_t *)&r->data[pos];
+
+		if (t->cb == task->cb && t->arg == task->arg)
+			t->cb = sched_task_nop;
+	}
+}
+
+void scheduler_cancel_task(sched_task_t *task)
+{
+	uint8_t flags, prio;
+
+	irq_save(flags);
+	if (!list_empty(&task->list))
+		list_del_init(&task->list);
+	for (prio = 0; prio < CONFIG_SCHEDULER_PRIO_NB; prio++) {
+		sched_ring_cancel(&queues[prio].ring, task);
+		sched_ring_cancel(&queues[prio].ring_irq, task);
+	}
+	irq_restore(flags);
+}
+
+void scheduler_stats(scheduler_stats_t *s)
+{
+	*s = stats;
+}
+
+#if CONFIG_SCHEDULER_CPUS > 1
+int scheduler_set_cpu(uint8_t cpu)
+{
+	if (cpu >= CONFIG_SCHEDULER_CPUS)
+		return -1;
+	sched_cpu = cpu;
+	return 0;
+}
+
+uint8_t scheduler_cpu(void)
+{
+	return sched_cpu;
+}
+
+int schedule_task_on(uint8_t cpu, void (*cb)(void *arg), void *arg)
 {
 	task_t task = {
 		.cb = cb,
 		.arg = arg,
 	};
-	ring_t *r = IRQ_CHECK() ? ring : ring_irq;
 
-	if (ring_add(r, &task, sizeof(task_t)) >= 0)
-		return;
-	DEBUG_LOG("cannot schedule task %p from %s:%d\n", cb, func, line);
+	if (cpu >= CONFIG_SCHEDULER_CPUS)
+		return -1;
+	return ring_mp_enqueue_bulk(&remote_queues[cpu].ring, &task, 1);
 }
 
-void scheduler_run_task(void)
+static inline uint8_t scheduler_has_remote_tasks(void)
 {
-	int irq_rlen = ring_len(ring_irq);
+	return !ring_mp_is_empty(&remote_queues[sched_cpu].ring);
+}
+
+static int scheduler_run_remote_tasks(int budget)
+{
+	ring_mp_t *r = &remote_queues[sched_cpu].ring;
+	task_t task;
+	int n;
+
+	for (n = 0; n < budget && ring_sc_dequeue_bulk(r, &task, 1) >= 0; n++)
+		task.cb(task.arg);
+	return n;
+}
+#else
+static inline uint8_t scheduler_has_remote_tasks(void)
+{
+	return 0;
+}
+
+static inline int scheduler_run_remote_tasks(int budget)
+{
+	return 0;
+}
+#endif
+
+#ifdef DEBUG
+void __schedule_task(void (*cb)(void *arg), void *arg,
+		     const char *func, int line)
+{
+	__schedule_task_prio(cb, arg, SCHEDULER_PRIO_NORMAL, func, line);
+}
+#else
+void schedule_task(void (*cb)(void *arg), void *arg)
+{
+	schedule_task_prio(cb, arg, SCHEDULER_PRIO_NORMAL);
+}
+#endif
+
+static inline uint8_t sched_queue_is_empty(const sched_queue_t *q)
+{
+	return ring_is_empty(&q->ring_irq) && ring_is_empty(&q->ring)
+		&& sched_overflow_is_empty(q);
+}
+
+/* Strict priority. A non-empty lower priority queue passed over
+ * CONFIG_SCHEDULER_AGING times is served once.
+ */
+static sched_queue_t *scheduler_pick_queue(void)
+{
+	sched_queue_t *first = NULL;
+	uint8_t prio;
+
+	for (prio = 0; prio < CONFIG_SCHEDULER_PRIO_NB; prio++) {
+		sched_queue_t *q = &queues[prio];
+
+		if (sched_queue_is_empty(q)) {
+			q->age = 0;
+			continue;
+		}
+		if (first == NULL) {
+			first = q;
+			continue;
+		}
+		if (++q->age >= CONFIG_SCHEDULER_AGING) {
+			q->age = 0;
+			return q;
+		}
+	}
+	if (first)
+		first->age = 0;
+	return first;
+}
+
+static uint8_t scheduler_irq_over_water_mark(void)
+{
+	uint8_t prio;
+
+	for (prio = 0; prio < CONFIG_SCHEDULER_PRIO_NB; prio++)
+		if (ring_len(&queues[prio].ring_irq)
+		    >= SCHEDULER_TASK_WATER_MARK)
+			return 1;
+	return 0;
+}
+
+uint8_t scheduler_has_tasks(void)
+{
+	uint8_t prio;
+
+	if (scheduler_has_remote_tasks())
+		return 1;
+	/* the queues belong to cpu 0 */
+	if (sched_cpu)
+		return 0;
+	for (prio = 0; prio < CONFIG_SCHEDULER_PRIO_NB; prio++)
+		if (!sched_queue_is_empty(&queues[prio]))
+			return 1;
+	return 0;
+}
+
+uint8_t scheduler_high_water_mark(uint8_t prio, uint8_t from_irq)
+{
+	if (prio >= CONFIG_SCHEDULER_PRIO_NB)
+		return 0;
+	return from_irq ? queues[prio].irq_high_water_mark :
+		queues[prio].high_water_mark;
+}
+
+static void scheduler_run_irq_task(sched_queue_t *q)
+{
+	if (scheduler_irq_over_water_mark())
+		irq_disable();
+	else
+		irq_enable();
+	__scheduler_run_task(&q->ring_irq);
+}
+
+/* overflowed tasks are older than the ones in the rings, run them first */
+static uint8_t scheduler_run_overflow_task(sched_queue_t *q)
+{
+	sched_task_t *task;
+	uint8_t flags;
 
+	if (sched_overflow_is_empty(q))
+		return 0;
+	irq_save(flags);
+	task = list_first_entry(&q->overflow, sched_task_t, list);
+	list_del_init(&task->list);
+	irq_restore(flags);
+	task->cb(task->arg);
 #ifdef CONFIG_POWER_MANAGEMENT
-	idle = 1;
+	idle = 0;
 #endif
-	if (irq_rlen) {
-		if (irq_rlen >= SCHEDULER_TASK_WATER_MARK)
-			irq_disable();
+	return 1;
+}
+
+int scheduler_run_tasks(int budget)
+{
+	sched_queue_t *q;
+	int n = scheduler_run_remote_tasks(budget);
+
+	if (sched_cpu)
+		return n;
+	for (; n < budget && (q = scheduler_pick_queue()); n++) {
+		if (scheduler_run_overflow_task(q))
+			continue;
+		if (!ring_is_empty(&q->ring_irq))
+			scheduler_run_irq_task(q);
 		else
-			irq_enable();
-		__scheduler_run_task(ring_irq);
+			__scheduler_run_task(&q->ring);
 	}
+	return n;
+}
 
-	if (ring_len(ring))
-		__scheduler_run_task(ring);
+void scheduler_run_task(void)
+{
+	sched_queue_t *q;
+
+#ifdef CONFIG_POWER_MANAGEMENT
+	idle = 1;
+#endif
+	/* tasks from other threads first, in the order they were sent */
+	if (scheduler_run_remote_tasks(1) || sched_cpu)
+		return;
+	q = scheduler_pick_queue();
+	if (q) {
+		scheduler_run_overflow_task(q);
+		if (!ring_is_empty(&q->ring_irq))
+			scheduler_run_irq_task(q);
+		if (!ring_is_empty(&q->ring))
+			__scheduler_run_task(&q->ring);
+	}
 
 #ifdef CONFIG_POWER_MANAGEMENT
 	if (idle) {
@@ -25,34 +25,173 @@
 #ifndef _SCHEDULER_H_
 #define _SCHEDULER_H_
 
+#include <stdint.h>
+#include "list.h"
+
+#ifndef CONFIG_SCHEDULER_PRIO_NB
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_SCHEDULER_PRIO_NB 1
+#else
+#define CONFIG_SCHEDULER_PRIO_NB 3
+#endif
+#endif
+
+/* number of cpus (x86 only), a cpu being a thread */
+#ifndef CONFIG_SCHEDULER_CPUS
+#define CONFIG_SCHEDULER_CPUS 1
+#endif
+#if CONFIG_SCHEDULER_CPUS > 1 && defined(CONFIG_AVR_MCU)
+#error "CONFIG_SCHEDULER_CPUS > 1 requires the multi producer ring"
+#endif
+
+/** Task priorities, 0 is the highest one
+ */
+#define SCHEDULER_PRIO_HIGH   0
+#define SCHEDULER_PRIO_NORMAL (CONFIG_SCHEDULER_PRIO_NB / 2)
+#define SCHEDULER_PRIO_LOW    (CONFIG_SCHEDULER_PRIO_NB - 1)
+
+/** Task embedded in its owner object
+ *
+ * When the task queue is full, an embedded task is linked on an
+ * overflow list, so scheduling it never fails. Scheduling a task
+ * already waiting on the overflow list has no effect.
+ */
+typedef struct sched_task {
+	list_t list;
+	void (*cb)(void *arg);
+	void *arg;
+} sched_task_t;
+
+/** Scheduler statistics
+ */
+typedef struct scheduler_stats {
+	uint16_t dropped;    /* tasks lost, queue full */
+	uint16_t overflowed; /* embedded tasks put on the overflow list */
+} scheduler_stats_t;
+
+/** Initialize an embedded task
+ *
+ * @param[in] task  task
+ * @param[in] cb    task function
+ * @param[in] arg   task function argument
+ */
+static inline void
+sched_task_init(sched_task_t *task, void (*cb)(void *arg), void *arg)
+{
+	INIT_LIST_HEAD(&task->list);
+	task->cb = cb;
+	task->arg = arg;
+}
+
+/** Schedule an embedded task
+ *
+ * This function cannot fail. It is safe from an interrupt handler.
+ * @param[in] task  initialized task
+ * @param[in] prio  priority
+ */
+void schedule_embedded_task(sched_task_t *task, uint8_t prio);
+
+/** Cancel an embedded task
+ *
+ * The task is removed from the overflow list and its copies waiting in
+ * the task queues will not run. Queued tasks with the same function and
+ * argument are cancelled too. Must be called from the task context
+ * before freeing the owner of a scheduled task.
+ * @param[in] task  task
+ */
+void scheduler_cancel_task(sched_task_t *task);
+
+/** Get scheduler statistics
+ *
+ * @param[out] stats  statistics
+ */
+void scheduler_stats(scheduler_stats_t *stats);
+
 #ifdef DEBUG
 void __schedule_task(void (*cb)(void *arg), void *arg,
 		     const char *func, int line);
+void __schedule_task_prio(void (*cb)(void *arg), void *arg, uint8_t prio,
+			  const char *func, int line);
 #define schedule_task(cb, arg) __schedule_task(cb, arg, __func__, __LINE__)
+#define schedule_task_prio(cb, arg, prio)				\
+	__schedule_task_prio(cb, arg, prio, __func__, __LINE__)
 #else
 
 /** Schedule task
  *
  * Scheduling tasks is safe from an interrupt handler and from an other task.
+ * The task is scheduled with the SCHEDULER_PRIO_NORMAL priority.
  * @param[in] cb  task function to be scheduled
  */
 void schedule_task(void (*cb)(void *arg), void *arg);
+
+/** Schedule task with a priority
+ *
+ * Higher priority tasks are run first. A lower priority task is not
+ * delayed more than CONFIG_SCHEDULER_AGING times.
+ * @param[in] cb    task function to be scheduled
+ * @param[in] prio  priority, from SCHEDULER_PRIO_HIGH to SCHEDULER_PRIO_LOW
+ */
+void schedule_task_prio(void (*cb)(void *arg), void *arg, uint8_t prio);
 #endif
 
+#if CONFIG_SCHEDULER_CPUS > 1
+/** Bind the calling thread to a cpu
+ *
+ * A thread that never calls this function runs on cpu 0. Cpu 0 owns
+ * the priority queues and the network stack. Other cpus only run the
+ * tasks sent to them with schedule_task_on() and must not call the
+ * other scheduler or stack functions.
+ * @param[in] cpu  cpu number, lower than CONFIG_SCHEDULER_CPUS
+ * @return 0 on success, -1 on failure
+ */
+int scheduler_set_cpu(uint8_t cpu);
+
+/** Get the cpu of the calling thread
+ *
+ * @return cpu number
+ */
+uint8_t scheduler_cpu(void);
+
+/** Schedule task on a cpu
+ *
+ * The task goes through the multi producer ring of the cpu, it is
+ * safe from any thread. Cpu 0 runs these tasks before its queued
+ * ones. Tasks sent by one thread run in order.
+ * @param[in] cpu  cpu number
+ * @param[in] cb   task function to be scheduled
+ * @param[in] arg  task function argument
+ * @return 0 on success, -1 if the ring is full
+ */
+int schedule_task_on(uint8_t cpu, void (*cb)(void *arg), void *arg);
+#endif
+
+/** Get the maximum number of tasks queued at a priority level
+ *
+ * @param[in] prio      priority
+ * @param[in] from_irq  1 for tasks scheduled from interrupt handlers
+ * @return high-water mark in number of tasks
+ */
+uint8_t scheduler_high_water_mark(uint8_t prio, uint8_t from_irq);
+
 /** Run first task in queue
  * This function should be called from the main loop of a user application
  */
 void scheduler_run_task(void);
 
-
-/** Run all tasks in loop
+/** Check if tasks are waiting to be run
  *
- * This function should be used as a main loop in user application
+ * @return 1 if at least one task is queued, 0 otherwise
  */
-static inline void scheduler_run_tasks(void)
-{
-	for (;;)
-		scheduler_run_task();
-}
+uint8_t scheduler_has_tasks(void);
+/** Run queued tasks
+ *
+ * Tasks are run in priority order until the queues are empty or the
+ * budget is exhausted. Tasks scheduled by the tasks being run are
+ * part of the same pass.
+ * @param[in] budget  maximum number of tasks to run
+ * @return number of tasks run
+ */
+int scheduler_run_tasks(int budget);
 
 #endif
@@ -31,11 +31,37 @@
 #include <common.h>
 #include "timer.h"
 
-#define TIMER_TABLE_SIZE 16
-#define TIMER_TABLE_MASK (TIMER_TABLE_SIZE - 1)
+/* Hierarchical timer wheel. Level n slots cover
+ * 2^(n * CONFIG_TIMER_WHEEL_BITS) ticks. A timer is inserted in the
+ * level matching its expiry and moved down at most once per level.
+ */
+#ifndef CONFIG_TIMER_WHEEL_BITS
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_TIMER_WHEEL_BITS 3
+#else
+#define CONFIG_TIMER_WHEEL_BITS 6
+#endif
+#endif
 
-static uint8_t cur_idx;
-static list_t timer_list[TIMER_TABLE_SIZE];
+#ifndef CONFIG_TIMER_WHEEL_LEVELS
+#ifdef CONFIG_AVR_MCU
+#define CONFIG_TIMER_WHEEL_LEVELS 3
+#else
+#define CONFIG_TIMER_WHEEL_LEVELS 4
+#endif
+#endif
+
+#define TIMER_WHEEL_SIZE (1U << CONFIG_TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+/* farther timers are parked in the last level */
+#define TIMER_WHEEL_RANGE						\
+	((uint32_t)1 << (CONFIG_TIMER_WHEEL_BITS * CONFIG_TIMER_WHEEL_LEVELS))
+
+static list_t timer_wheel[CONFIG_TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+/* last tick processed by the wheel, catches up with timer_ticks */
+static uint32_t wheel_ticks;
 uint32_t timer_ticks;
 
 #ifdef DEBUG_TIMERS
@@ -60,58 +86,149 @@ static void timer_dump_list(list_t *head)
 
 void timer_dump(void)
 {
-	uint8_t i;
+	uint8_t i, j;
 	uint8_t flags;
 
 	irq_save(flags);
-	for (i = 0; i < TIMER_TABLE_SIZE; i++)
-		timer_dump_list(&timer_list[i]);
+	for (i = 0; i < CONFIG_TIMER_WHEEL_LEVELS; i++)
+		for (j = 0; j < TIMER_WHEEL_SIZE; j++)
+			timer_dump_list(&timer_wheel[i][j]);
 	irq_restore(flags);
 }
 #endif
 
-static uint8_t ticks_to_idx(uint32_t *delta_ticks)
+static void timer_wheel_add(tim_t *timer)
+{
+	uint32_t expires = timer->expires;
+	uint32_t delta = expires - wheel_ticks;
+	uint8_t level = 0;
+
+	if (delta >= TIMER_WHEEL_RANGE) {
+		expires = wheel_ticks + TIMER_WHEEL_RANGE - 1;
+		delta = TIMER_WHEEL_RANGE - 1;
+	}
+	while (delta >= TIMER_WHEEL_SIZE) {
+		delta >>= CONFIG_TIMER_WHEEL_BITS;
+		level++;
+	}
+	expires >>= level * CONFIG_TIMER_WHEEL_BITS;
+	list_add_tail(&timer->list,
+		      &timer_wheel[level][expires & TIMER_WHEEL_MASK]);
+}
+
+/* move the timers of the current slot of a level to the lower levels */
+static void timer_cascade(uint8_t level)
+{
+	uint8_t idx = (wheel_ticks >> (level * CONFIG_TIMER_WHEEL_BITS))
+		& TIMER_WHEEL_MASK;
+	LIST_HEAD(timers);
+
+	list_move_tail_list(&timers, &timer_wheel[level][idx]);
+	while (!list_empty(&timers)) {
+		tim_t *timer = list_first_entry(&timers, tim_t, list);
+
+		list_del(&timer->list);
+		timer_wheel_add(timer);
+	}
+}
+
+#ifdef CONFIG_TIMER_TICKLESS
+/* tick of the next occupied slot, upper level slots are due when they
+ * cascade
+ */
+static int timer_wheel_next(uint32_t *next)
 {
-	uint8_t idx;
-
-	if (*delta_ticks >= TIMER_TABLE_SIZE) {
-		idx = cur_idx - 1;
-		*delta_ticks -= TIMER_TABLE_MASK;
-	} else {
-		idx = cur_idx + *delta_ticks;
-		*delta_ticks = 0;
+	uint8_t level, found = 0;
+
+	for (level = 0; level < CONFIG_TIMER_WHEEL_LEVELS; level++) {
+		uint8_t shift = level * CONFIG_TIMER_WHEEL_BITS;
+		uint32_t idx = wheel_ticks >> shift;
+		uint16_t i;
+
+		for (i = 1; i <= TIMER_WHEEL_SIZE; i++) {
+			uint32_t t = (idx + i) << shift;
+
+			if (list_empty(&timer_wheel[level][(idx + i)
+							   & TIMER_WHEEL_MASK]))
+				continue;
+			if (!found || (int32_t)(t - *next) < 0) {
+				*next = t;
+				found = 1;
+			}
+			break;
+		}
 	}
-	idx &= TIMER_TABLE_MASK;
-	return idx;
+	return found ? 0 : -1;
 }
 
+/* after a sleep, jump over the ticks without timers */
+static void timer_wheel_skip(void)
+{
+	uint32_t next;
+
+	if (timer_wheel_next(&next) < 0 || (int32_t)(next - timer_ticks) > 0)
+		next = timer_ticks;
+	if ((int32_t)(next - 1 - wheel_ticks) > 0)
+		wheel_ticks = next - 1;
+}
+#endif
+
 void timer_process(void)
 {
-	cur_idx = (cur_idx + 1) & TIMER_TABLE_MASK;
 	timer_ticks++;
 
-	while (!list_empty(&timer_list[cur_idx])) {
-		tim_t *timer = list_first_entry(&timer_list[cur_idx], tim_t,
-						list);
-
-		if (timer->ticks > 0) {
-			uint8_t i = ticks_to_idx(&timer->ticks);
+	while (wheel_ticks != timer_ticks) {
+		list_t *slot;
+		uint8_t level = 0;
 
-			list_move_tail(&timer->list, &timer_list[i]);
-			continue;
+#ifdef CONFIG_TIMER_TICKLESS
+		if (timer_ticks - wheel_ticks > 1)
+			timer_wheel_skip();
+#endif
+		wheel_ticks++;
+		while (level < CONFIG_TIMER_WHEEL_LEVELS - 1
+		       && ((wheel_ticks >> (level * CONFIG_TIMER_WHEEL_BITS))
+			   & TIMER_WHEEL_MASK) == 0)
+			timer_cascade(++level);
+
+		slot = &timer_wheel[0][wheel_ticks & TIMER_WHEEL_MASK];
+		while (!list_empty(slot)) {
+			tim_t *timer = list_first_entry(slot, tim_t, list);
+
+			list_del_init(&timer->list);
+			(*timer->cb)(timer->arg);
 		}
-		list_del_init(&timer->list);
-		(*timer->cb)(timer->arg);
 	}
 }
 
-void timer_subsystem_init(void)
+#ifdef CONFIG_TIMER_TICKLESS
+int32_t timer_next_expiry(void)
 {
-	int i;
+	uint32_t next;
+	int32_t ret = -1;
+	uint8_t flags;
+
+	irq_save(flags);
+	if (timer_wheel_next(&next) >= 0) {
+		ret = next - timer_ticks;
+		if (ret < 0)
+			ret = 0;
+	}
+	irq_restore(flags);
+	return ret;
+}
+#endif
 
-	STATIC_ASSERT(TIMER_TABLE_SIZE < MAX_VALUE_UNSIGNED(cur_idx));
-	for (i = 0; i < TIMER_TABLE_SIZE; i++)
-		INIT_LIST_HEAD(&timer_list[i]);
+void timer_subsystem_init(void)
+{
+	int i, j;
+
+	STATIC_ASSERT(CONFIG_TIMER_WHEEL_BITS * CONFIG_TIMER_WHEEL_LEVELS < 32);
+	STATIC_ASSERT(TIMER_WHEEL_SIZE <= 256);
+	for (i = 0; i < CONFIG_TIMER_WHEEL_LEVELS; i++)
+		for (j = 0; j < TIMER_WHEEL_SIZE; j++)
+			INIT_LIST_HEAD(&timer_wheel[i][j]);
+	wheel_ticks = timer_ticks;
 	__timer_subsystem_init();
 }
 
@@ -128,7 +245,7 @@ void timer_add(tim_t *timer, uint32_t expiry, void (*cb)(void *), void *arg)
 
 #endif
 {
-	uint8_t idx;
+	uint32_t ticks;
 	uint8_t flags;
 
 	if (timer_is_pending(timer)) {
@@ -142,18 +259,18 @@ void timer_add(tim_t *timer, uint32_t expiry, void (*cb)(void *), void *arg)
 	timer->func = func;
 	timer->line = line;
 #endif
-	timer->ticks = expiry / CONFIG_TIMER_RESOLUTION_US;
+	ticks = expiry / CONFIG_TIMER_RESOLUTION_US;
 
-	/* don't schedule at current idx */
-	if (timer->ticks == 0)
-		timer->ticks = 1;
+	/* don't schedule at current tick */
+	if (ticks == 0)
+		ticks = 1;
 
 	timer->cb = cb;
 	timer->arg = arg;
 
 	irq_save(flags);
-	idx = ticks_to_idx(&timer->ticks);
-	list_add_tail(&timer->list, &timer_list[idx]);
+	timer->expires = timer_ticks + ticks;
+	timer_wheel_add(timer);
 	irq_restore(flags);
 }
 
@@ -39,7 +39,7 @@ struct timer {
 	const char *func;
 	unsigned line;
 #endif
-	uint32_t ticks;
+	uint32_t expires; /* expiry tick */
 } __PACKED__;
 typedef struct timer tim_t;
 
@@ -129,6 +129,16 @@ void timer_del(tim_t *timer);
  */
 void timer_process(void);
 
+#ifdef CONFIG_TIMER_TICKLESS
+/** Get the number of ticks before the next timer expiry
+ *
+ * The result may be earlier than the actual expiry of a far timer as
+ * its wheel slot has to be cascaded first.
+ * @return number of ticks, -1 if no timer is pending
+ */
+int32_t timer_next_expiry(void);
+#endif
+
 /** Check if timer is pending
  *
  * @param[in] timer  timer